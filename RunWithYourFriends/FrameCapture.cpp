@@ -0,0 +1,182 @@
+#include "FrameCapture.h"
+#include <cstdio>
+#include <cstring>
+#include "SFML/OpenGL.hpp"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+	//Makes the folder if it is missing, then proves a file can be written into it
+	bool prepareFolder(const std::string& path)
+	{
+#ifdef _WIN32
+		_mkdir(path.c_str());
+#else
+		mkdir(path.c_str(), 0755);
+#endif
+
+		std::string probePath{ path + "/.capture_probe" };
+		bool writable{ std::ofstream(probePath, std::ios::binary).is_open() };
+		std::remove(probePath.c_str());
+
+		return writable;
+	}
+}
+
+capture::FrameCapture::FrameCapture(const std::string& outputPath, Format format, unsigned int width, unsigned int height, unsigned int poolSize) :
+	m_outputPath{ outputPath }, m_format{ format }, m_width{ width }, m_height{ height },
+	m_pool(poolSize, std::vector<sf::Uint8>(width * height * 4)), m_flipBuffer(width * height * 4)
+{
+	for (unsigned int i{}; i < poolSize; ++i)
+	{
+		m_freeBuffers.push_back(i);
+	}
+
+	if (m_format == Format::Raw)
+	{
+		m_rawFile.open(m_outputPath, std::ios::binary);
+		m_failed = !m_rawFile.is_open();
+	}
+	else
+	{
+		m_failed = !prepareFolder(m_outputPath);
+	}
+
+	m_encoder = std::thread(&FrameCapture::encodeLoop, this);
+}
+
+capture::FrameCapture::~FrameCapture()
+{
+	finish();
+}
+
+void capture::FrameCapture::capture(sf::RenderTexture& texture)
+{
+	unsigned int buffer{};
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_bufferFreed.wait(lock, [this] { return !m_freeBuffers.empty(); });
+		buffer = m_freeBuffers.back();
+		m_freeBuffers.pop_back();
+	}
+
+	//Straight into the pooled buffer, no per frame sf::Image
+	texture.setActive(true);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, m_pool[buffer].data());
+	texture.setActive(false);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queuedBuffers.push_back(buffer);
+		m_queuedFrames.push_back(m_frameCount++);
+	}
+	m_frameQueued.notify_one();
+}
+
+void capture::FrameCapture::finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_finishing = true;
+	}
+	m_frameQueued.notify_one();
+
+	if (m_encoder.joinable())
+	{
+		m_encoder.join();
+	}
+
+	if (m_rawFile.is_open())
+	{
+		m_rawFile.close();
+	}
+}
+
+void capture::FrameCapture::encodeLoop()
+{
+	while (true)
+	{
+		unsigned int buffer{};
+		unsigned int frame{};
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_frameQueued.wait(lock, [this] { return !m_queuedBuffers.empty() || m_finishing; });
+
+			if (m_queuedBuffers.empty())
+			{
+				return;
+			}
+
+			buffer = m_queuedBuffers.front();
+			frame = m_queuedFrames.front();
+			m_queuedBuffers.pop_front();
+			m_queuedFrames.pop_front();
+		}
+
+		writeFrame(m_pool[buffer], frame);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_freeBuffers.push_back(buffer);
+		}
+		m_bufferFreed.notify_one();
+	}
+}
+
+//GL hands rows back bottom first, they are flipped here on the encoder thread
+void capture::FrameCapture::writeFrame(const std::vector<sf::Uint8>& pixels, unsigned int frame)
+{
+	if (m_failed)
+	{
+		return;
+	}
+
+	unsigned int rowSize{ m_width * 4 };
+
+	if (m_format == Format::Raw)
+	{
+		for (unsigned int row{ m_height }; row-- > 0;)
+		{
+			m_rawFile.write((const char*)pixels.data() + row * rowSize, rowSize);
+		}
+
+		m_failed = !m_rawFile.good();
+	}
+	else
+	{
+		for (unsigned int row{}; row < m_height; ++row)
+		{
+			std::memcpy(m_flipBuffer.data() + row * rowSize, pixels.data() + (m_height - 1 - row) * rowSize, rowSize);
+		}
+
+		char fileName[32];
+		std::snprintf(fileName, sizeof(fileName), "/frame_%05u.png", frame);
+
+		sf::Image image;
+		image.create(m_width, m_height, m_flipBuffer.data());
+		m_failed = !image.saveToFile(m_outputPath + fileName);
+	}
+
+	if (!m_failed)
+	{
+		++m_framesWritten;
+	}
+}
+
+unsigned int capture::FrameCapture::getFramesWritten()
+{
+	return m_framesWritten;
+}
+
+bool capture::FrameCapture::getFailed()
+{
+	return m_failed;
+}
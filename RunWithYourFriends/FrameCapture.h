@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "SFML/Graphics.hpp"
+
+namespace capture
+{
+	enum class Format
+	{
+		Png,
+		Raw
+	};
+
+	//Reads rendered frames back into a fixed pool of pixel buffers and hands them to a
+	//background thread that writes them out, the caller only waits when every buffer is in flight
+	class FrameCapture
+	{
+	private:
+		std::string m_outputPath;
+		Format m_format;
+		unsigned int m_width;
+		unsigned int m_height;
+
+		std::vector<std::vector<sf::Uint8>> m_pool;
+		std::vector<unsigned int> m_freeBuffers;
+		std::deque<unsigned int> m_queuedBuffers;
+		std::deque<unsigned int> m_queuedFrames;
+		std::mutex m_mutex;
+		std::condition_variable m_bufferFreed;
+		std::condition_variable m_frameQueued;
+		bool m_finishing{ false };
+
+		std::ofstream m_rawFile;
+		std::vector<sf::Uint8> m_flipBuffer;
+		unsigned int m_frameCount{ 0 };
+		unsigned int m_framesWritten{ 0 };
+		std::atomic<bool> m_failed{ false };
+
+		std::thread m_encoder;
+
+		void encodeLoop();
+		void writeFrame(const std::vector<sf::Uint8>& pixels, unsigned int frame);
+
+	public:
+		//Creates the PNG folder if needed, check getFailed before capturing anything
+		FrameCapture(const std::string& outputPath, Format format, unsigned int width, unsigned int height, unsigned int poolSize = 8);
+		~FrameCapture();
+
+		void capture(sf::RenderTexture& texture);
+		void finish();
+
+		unsigned int getFramesWritten();
+		bool getFailed();
+	};
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+
+//Rules shared by the game objects and the batch training environment. Keeping them in one
+//place is what makes difficulty tuned by the trainer hold up in the real game.
+
+const float gravity{ 9.8 };
+
+const float characterGravityModifier{ 0.033 };
+const float characterAirResistance{ 0.5 };
+const float characterGroundResistance{ 0.1 };
+const float characterMovementSpeed{ 1 };
+const float characterJumpForce{ 3 };
+
+//Level layout for the 320x180 view. World builds its fixed objects from these and the
+//trainer collides against the same boxes, so moving anything here moves it in both.
+const float levelWidth{ 320 };
+const float levelHeight{ 180 };
+
+//Objects this far outside the level are killed
+const float levelBoundsMargin{ 100 };
+
+struct LevelBox
+{
+	float left;
+	float top;
+	float width;
+	float height;
+
+	//Collision box x relative to the object, only the kill volume's sprite sits apart from its box
+	float collisionOffset;
+	bool isKill;
+};
+
+const LevelBox levelGround{ -100, 150, 500, 30, 0, false };
+const LevelBox levelCeiling{ 0, -10, 319, 10, 0, false };
+const LevelBox levelSpawnerColumn{ 310, 0, 10, levelHeight, 0, false };
+const LevelBox levelKillVolume{ -50, -30, 51, levelHeight + 30, -50, true };
+
+const float playerSize{ 16 };
+const float playerStartX{ 100 };
+const float playerStartY{ 130 };
+const float playerSpacing{ 20 };
+
+const float obstacleSpawnX{ 320 };
+const float obstacleSpawnY{ 120 };
+
+//Small xorshift generator so the spawn sequence is part of the simulation state
+struct Random
+{
+	std::uint32_t state;
+
+	std::uint32_t next()
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+};
+
+enum InputBits : std::uint8_t
+{
+	InputRight = 1,
+	InputLeft = 2,
+	InputJump = 4
+};
+
+//Everything the obstacle spawner decides with, chances are out of 100
+struct DifficultyParameters
+{
+	float startSpeed{ 1 };
+	double speedIncrease{ 0.001 };
+	int spawnChance{ 29 };
+	float minSpawnDistance{ 60.0 };
+	int rockChance{ 33 };
+	int stumpChance{ 33 };
+};
@@ -0,0 +1,720 @@
+#include "Spectator.h"
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+	const std::uint8_t keyframeType{ 1 };
+	const std::uint8_t deltaType{ 2 };
+
+	//Fields are written in host byte order, every platform the game ships on is little endian
+	template <typename T>
+	void put(std::vector<char>& out, T value)
+	{
+		std::size_t offset{ out.size() };
+		out.resize(offset + sizeof(T));
+		std::memcpy(out.data() + offset, &value, sizeof(T));
+	}
+
+	struct Reader
+	{
+		const char* data;
+		std::size_t size;
+		std::size_t position;
+
+		template <typename T>
+		bool get(T& value)
+		{
+			if (size - position < sizeof(T))
+			{
+				return false;
+			}
+
+			std::memcpy(&value, data + position, sizeof(T));
+			position += sizeof(T);
+			return true;
+		}
+	};
+
+	void putEntity(std::vector<char>& out, const spectator::EntityView& entity)
+	{
+		put(out, entity.id);
+		put(out, entity.x);
+		put(out, entity.y);
+		put(out, entity.color);
+		put(out, entity.animation);
+		put(out, entity.frame);
+	}
+
+	bool getEntity(Reader& reader, spectator::EntityView& entity)
+	{
+		return reader.get(entity.id) && reader.get(entity.x) && reader.get(entity.y) && reader.get(entity.color) && reader.get(entity.animation) && reader.get(entity.frame);
+	}
+
+	void putBackground(std::vector<char>& out, const spectator::FrameView& frame)
+	{
+		put(out, (std::uint8_t)frame.backgroundOffsets.size());
+
+		for (unsigned int i{}; i < frame.backgroundOffsets.size(); ++i)
+		{
+			put(out, frame.backgroundOffsets[i]);
+		}
+	}
+
+	bool getBackground(Reader& reader, spectator::FrameView& frame)
+	{
+		std::uint8_t layerCount{};
+		if (!reader.get(layerCount))
+		{
+			return false;
+		}
+
+		frame.backgroundOffsets.resize(layerCount);
+		for (unsigned int i{}; i < layerCount; ++i)
+		{
+			if (!reader.get(frame.backgroundOffsets[i]))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool sameEntity(const spectator::EntityView& a, const spectator::EntityView& b)
+	{
+		return a.x == b.x && a.y == b.y && a.color == b.color && a.animation == b.animation && a.frame == b.frame;
+	}
+
+	bool lessById(const spectator::EntityView& entity, std::uint32_t id)
+	{
+		return entity.id < id;
+	}
+
+	//Room for the length, filled in once the body is written
+	std::vector<char>* beginMessage(std::uint8_t type, std::uint32_t tick)
+	{
+		std::vector<char>* out{ new std::vector<char>() };
+		out->reserve(512);
+		put(*out, (std::uint32_t)0);
+		put(*out, type);
+		put(*out, tick);
+		return out;
+	}
+
+	spectator::Message endMessage(std::vector<char>* out)
+	{
+		std::uint32_t length{ (std::uint32_t)(out->size() - sizeof(std::uint32_t)) };
+		std::memcpy(out->data(), &length, sizeof(length));
+		return spectator::Message(out);
+	}
+
+	//Splits length prefixed messages off the front of buffer, leaving any partial one behind
+	template <typename Handler>
+	void splitMessages(std::vector<char>& buffer, Handler handler)
+	{
+		std::size_t offset{};
+
+		while (buffer.size() - offset >= sizeof(std::uint32_t))
+		{
+			std::uint32_t length{};
+			std::memcpy(&length, buffer.data() + offset, sizeof(length));
+
+			if (buffer.size() - offset - sizeof(length) < length)
+			{
+				break;
+			}
+
+			handler(buffer.data() + offset, sizeof(length) + length);
+			offset += sizeof(length) + length;
+		}
+
+		buffer.erase(buffer.begin(), buffer.begin() + offset);
+	}
+
+	//False once the socket is gone
+	bool receiveAll(sf::TcpSocket& socket, std::vector<char>& buffer)
+	{
+		char chunk[16384];
+		std::size_t received{};
+		sf::Socket::Status status{};
+
+		while ((status = socket.receive(chunk, sizeof(chunk), received)) == sf::Socket::Done)
+		{
+			buffer.insert(buffer.end(), chunk, chunk + received);
+		}
+
+		return status == sf::Socket::NotReady;
+	}
+}
+
+spectator::Message spectator::encodeKeyframe(const FrameView& frame)
+{
+	std::vector<char>* out{ beginMessage(keyframeType, frame.tick) };
+
+	putBackground(*out, frame);
+
+	put(*out, (std::uint16_t)frame.entities.size());
+	for (unsigned int i{}; i < frame.entities.size(); ++i)
+	{
+		putEntity(*out, frame.entities[i]);
+	}
+
+	return endMessage(out);
+}
+
+spectator::Message spectator::encodeDelta(const FrameView& previous, const FrameView& current)
+{
+	std::vector<char>* out{ beginMessage(deltaType, current.tick) };
+	put(*out, previous.tick);
+	putBackground(*out, current);
+
+	//Both lists are sorted by id, so one walk finds what left, what arrived and what changed
+	std::vector<std::uint32_t> removed;
+	std::vector<const EntityView*> changed;
+	unsigned int p{}, c{};
+
+	while (p < previous.entities.size() || c < current.entities.size())
+	{
+		if (c == current.entities.size() || (p < previous.entities.size() && previous.entities[p].id < current.entities[c].id))
+		{
+			removed.push_back(previous.entities[p++].id);
+		}
+		else if (p == previous.entities.size() || current.entities[c].id < previous.entities[p].id)
+		{
+			changed.push_back(&current.entities[c++]);
+		}
+		else
+		{
+			if (!sameEntity(previous.entities[p], current.entities[c]))
+			{
+				changed.push_back(&current.entities[c]);
+			}
+			++p;
+			++c;
+		}
+	}
+
+	put(*out, (std::uint16_t)removed.size());
+	for (unsigned int i{}; i < removed.size(); ++i)
+	{
+		put(*out, removed[i]);
+	}
+
+	put(*out, (std::uint16_t)changed.size());
+	for (unsigned int i{}; i < changed.size(); ++i)
+	{
+		putEntity(*out, *changed[i]);
+	}
+
+	return endMessage(out);
+}
+
+bool spectator::isKeyframe(const Message& message)
+{
+	return message->size() > sizeof(std::uint32_t) && (std::uint8_t)(*message)[sizeof(std::uint32_t)] == keyframeType;
+}
+
+bool spectator::applyMessage(const char* data, std::size_t size, FrameView& frame)
+{
+	Reader reader{ data, size, sizeof(std::uint32_t) };
+	std::uint8_t type{};
+	std::uint32_t tick{};
+
+	if (!reader.get(type) || !reader.get(tick))
+	{
+		return false;
+	}
+
+	FrameView result;
+
+	if (type == keyframeType)
+	{
+		std::uint16_t count{};
+		if (!getBackground(reader, result) || !reader.get(count))
+		{
+			return false;
+		}
+
+		result.entities.resize(count);
+		for (unsigned int i{}; i < count; ++i)
+		{
+			if (!getEntity(reader, result.entities[i]))
+			{
+				return false;
+			}
+		}
+	}
+	else if (type == deltaType)
+	{
+		std::uint32_t baseTick{};
+		if (!reader.get(baseTick) || baseTick != frame.tick)
+		{
+			return false;
+		}
+
+		result = frame;
+
+		std::uint16_t count{};
+		if (!getBackground(reader, result) || !reader.get(count))
+		{
+			return false;
+		}
+
+		for (unsigned int i{}; i < count; ++i)
+		{
+			std::uint32_t id{};
+			if (!reader.get(id))
+			{
+				return false;
+			}
+
+			auto found{ std::lower_bound(result.entities.begin(), result.entities.end(), id, lessById) };
+			if (found != result.entities.end() && found->id == id)
+			{
+				result.entities.erase(found);
+			}
+		}
+
+		if (!reader.get(count))
+		{
+			return false;
+		}
+
+		for (unsigned int i{}; i < count; ++i)
+		{
+			EntityView entity{};
+			if (!getEntity(reader, entity))
+			{
+				return false;
+			}
+
+			auto found{ std::lower_bound(result.entities.begin(), result.entities.end(), entity.id, lessById) };
+			if (found != result.entities.end() && found->id == entity.id)
+			{
+				*found = entity;
+			}
+			else
+			{
+				result.entities.insert(found, entity);
+			}
+		}
+	}
+	else
+	{
+		return false;
+	}
+
+	result.tick = tick;
+	frame = std::move(result);
+	return true;
+}
+
+bool spectator::sameFrame(const FrameView& a, const FrameView& b)
+{
+	if (a.tick != b.tick || a.backgroundOffsets != b.backgroundOffsets || a.entities.size() != b.entities.size())
+	{
+		return false;
+	}
+
+	for (unsigned int i{}; i < a.entities.size(); ++i)
+	{
+		if (a.entities[i].id != b.entities[i].id || !sameEntity(a.entities[i], b.entities[i]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void spectator::MessageQueue::push(const Message& message)
+{
+	m_messages.push_back(message);
+}
+
+bool spectator::MessageQueue::flush(sf::TcpSocket& socket)
+{
+	while (!m_messages.empty())
+	{
+		const std::vector<char>& data{ *m_messages.front() };
+		std::size_t sent{};
+		sf::Socket::Status status{ socket.send(data.data() + m_sent, data.size() - m_sent, sent) };
+
+		m_sent += sent;
+
+		if (status == sf::Socket::Done)
+		{
+			m_messages.pop_front();
+			m_sent = 0;
+		}
+		else if (status == sf::Socket::Partial || status == sf::Socket::NotReady)
+		{
+			return true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void spectator::MessageQueue::dropUnsent()
+{
+	if (m_messages.empty())
+	{
+		return;
+	}
+
+	Message front{ m_messages.front() };
+	m_messages.clear();
+
+	if (m_sent > 0)
+	{
+		m_messages.push_back(front);
+	}
+}
+
+std::size_t spectator::MessageQueue::size()
+{
+	return m_messages.size();
+}
+
+spectator::Broadcaster::Broadcaster(unsigned int keyframeInterval, unsigned int retryInterval) :
+	m_socket{ new sf::TcpSocket() }, m_keyframeInterval{ keyframeInterval }, m_retryInterval{ retryInterval }{}
+
+spectator::Broadcaster::~Broadcaster()
+{
+	if (m_connector.joinable())
+	{
+		m_connector.join();
+	}
+}
+
+bool spectator::Broadcaster::connect(const std::string& host, unsigned short port)
+{
+	if (m_connector.joinable())
+	{
+		m_connector.join();
+	}
+
+	m_host = host;
+	m_port = port;
+	m_sinceRetry = 0;
+
+	m_socket.reset(new sf::TcpSocket());
+	m_connected = m_socket->connect(sf::IpAddress(host), port, sf::seconds(2)) == sf::Socket::Done;
+
+	if (m_connected)
+	{
+		m_socket->setBlocking(false);
+		m_queue = MessageQueue();
+		m_needKeyframe = true;
+	}
+
+	return m_connected;
+}
+
+void spectator::Broadcaster::startReconnect()
+{
+	m_pendingSocket.reset(new sf::TcpSocket());
+	m_connectDone = false;
+
+	sf::TcpSocket* socket{ m_pendingSocket.get() };
+	std::string host{ m_host };
+	unsigned short port{ m_port };
+
+	m_connector = std::thread([this, socket, host, port]()
+	{
+		m_connectSucceeded = socket->connect(sf::IpAddress(host), port, sf::seconds(1)) == sf::Socket::Done;
+		m_connectDone = true;
+	});
+}
+
+//Takes over the socket once the connector thread is done, false while it is still trying or failed
+bool spectator::Broadcaster::finishReconnect()
+{
+	if (!m_connectDone)
+	{
+		return false;
+	}
+
+	m_connector.join();
+
+	if (!m_connectSucceeded)
+	{
+		m_pendingSocket.reset();
+		return false;
+	}
+
+	m_socket = std::move(m_pendingSocket);
+	m_socket->setBlocking(false);
+	m_queue = MessageQueue();
+	m_needKeyframe = true;
+
+	return true;
+}
+
+void spectator::Broadcaster::publish(const FrameView& frame)
+{
+	//A lost relay is retried every so often on a separate thread, the game never waits for it
+	if (!m_connected)
+	{
+		if (m_connector.joinable())
+		{
+			m_connected = finishReconnect();
+		}
+		else if (!m_host.empty() && ++m_sinceRetry >= m_retryInterval)
+		{
+			m_sinceRetry = 0;
+			startReconnect();
+		}
+
+		if (!m_connected)
+		{
+			return;
+		}
+	}
+
+	Message message;
+
+	if (m_needKeyframe || ++m_sinceKeyframe >= m_keyframeInterval)
+	{
+		message = encodeKeyframe(frame);
+		m_needKeyframe = false;
+		m_sinceKeyframe = 0;
+	}
+	else
+	{
+		message = encodeDelta(m_previous, frame);
+	}
+
+	m_previous = frame;
+	m_queue.push(message);
+
+	//The relay fell behind, skip ahead rather than stall the game
+	if (m_queue.size() > maxQueuedMessages)
+	{
+		m_queue.dropUnsent();
+		m_needKeyframe = true;
+	}
+
+	m_connected = m_queue.flush(*m_socket);
+}
+
+void spectator::Broadcaster::forceKeyframe()
+{
+	m_needKeyframe = true;
+}
+
+bool spectator::Broadcaster::isConnected()
+{
+	return m_connected;
+}
+
+spectator::Relay::Relay(std::size_t maxQueued) : m_maxQueued{ maxQueued }{}
+
+bool spectator::Relay::listen(unsigned short publisherPort, unsigned short viewerPort)
+{
+	if (m_publisherListener.listen(publisherPort) != sf::Socket::Done || m_viewerListener.listen(viewerPort) != sf::Socket::Done)
+	{
+		return false;
+	}
+
+	m_publisherListener.setBlocking(false);
+	m_viewerListener.setBlocking(false);
+	m_selector.add(m_publisherListener);
+	m_selector.add(m_viewerListener);
+
+	return true;
+}
+
+void spectator::Relay::acceptPublisher()
+{
+	std::unique_ptr<sf::TcpSocket> socket{ new sf::TcpSocket() };
+
+	if (m_publisherListener.accept(*socket) != sf::Socket::Done)
+	{
+		return;
+	}
+
+	//The live broadcast keeps the slot, a stray connection is closed as the socket goes out of scope
+	if (m_publisher)
+	{
+		return;
+	}
+
+	socket->setBlocking(false);
+	m_publisher = std::move(socket);
+	m_selector.add(*m_publisher);
+
+	m_incoming.clear();
+	m_keyframe.reset();
+	m_deltas.clear();
+}
+
+void spectator::Relay::acceptViewers()
+{
+	while (true)
+	{
+		std::unique_ptr<sf::TcpSocket> socket{ new sf::TcpSocket() };
+
+		if (m_viewerListener.accept(*socket) != sf::Socket::Done)
+		{
+			return;
+		}
+
+		socket->setBlocking(false);
+		Connection connection{ std::move(socket), MessageQueue(), !m_keyframe };
+
+		if (m_keyframe)
+		{
+			connection.queue.push(m_keyframe);
+
+			for (unsigned int i{}; i < m_deltas.size(); ++i)
+			{
+				connection.queue.push(m_deltas[i]);
+			}
+		}
+
+		m_viewers.push_back(std::move(connection));
+	}
+}
+
+void spectator::Relay::receivePublisher()
+{
+	bool connected{ receiveAll(*m_publisher, m_incoming) };
+
+	splitMessages(m_incoming, [this](const char* data, std::size_t size)
+	{
+		relay(Message(new std::vector<char>(data, data + size)));
+	});
+
+	if (!connected)
+	{
+		m_selector.remove(*m_publisher);
+		m_publisher.reset();
+	}
+}
+
+void spectator::Relay::relay(const Message& message)
+{
+	++m_messagesReceived;
+
+	bool keyframe{ isKeyframe(message) };
+
+	if (keyframe)
+	{
+		m_keyframe = message;
+		m_deltas.clear();
+	}
+	else if (m_keyframe)
+	{
+		m_deltas.push_back(message);
+	}
+
+	for (unsigned int i{}; i < m_viewers.size(); ++i)
+	{
+		Connection& viewer{ m_viewers[i] };
+
+		if (viewer.waitingForKeyframe)
+		{
+			if (!keyframe)
+			{
+				continue;
+			}
+			viewer.waitingForKeyframe = false;
+		}
+
+		viewer.queue.push(message);
+
+		//A viewer this far behind skips to the next keyframe instead of holding everyone's memory
+		if (viewer.queue.size() > m_maxQueued)
+		{
+			viewer.queue.dropUnsent();
+			viewer.waitingForKeyframe = true;
+		}
+	}
+}
+
+void spectator::Relay::update(sf::Time timeout)
+{
+	//Viewers never send, so only the listeners and the publisher are waited on
+	if (m_selector.wait(timeout))
+	{
+		if (m_selector.isReady(m_publisherListener))
+		{
+			acceptPublisher();
+		}
+
+		if (m_selector.isReady(m_viewerListener))
+		{
+			acceptViewers();
+		}
+
+		if (m_publisher && m_selector.isReady(*m_publisher))
+		{
+			receivePublisher();
+		}
+	}
+
+	for (unsigned int i{ (unsigned int)m_viewers.size() }; i-- > 0;)
+	{
+		if (!m_viewers[i].queue.flush(*m_viewers[i].socket))
+		{
+			m_viewers.erase(m_viewers.begin() + i);
+		}
+	}
+}
+
+unsigned int spectator::Relay::getViewerCount()
+{
+	return (unsigned int)m_viewers.size();
+}
+
+std::uint64_t spectator::Relay::getMessagesReceived()
+{
+	return m_messagesReceived;
+}
+
+bool spectator::Viewer::connect(const std::string& host, unsigned short port)
+{
+	m_connected = m_socket.connect(sf::IpAddress(host), port, sf::seconds(2)) == sf::Socket::Done;
+
+	if (m_connected)
+	{
+		m_socket.setBlocking(false);
+	}
+
+	return m_connected;
+}
+
+bool spectator::Viewer::update()
+{
+	if (!m_connected)
+	{
+		return false;
+	}
+
+	m_connected = receiveAll(m_socket, m_incoming);
+
+	splitMessages(m_incoming, [this](const char* data, std::size_t size)
+	{
+		//Until the next keyframe anything that does not follow on is dropped
+		m_synced = applyMessage(data, size, m_frame);
+	});
+
+	return m_connected;
+}
+
+const spectator::FrameView& spectator::Viewer::getFrame()
+{
+	return m_frame;
+}
+
+bool spectator::Viewer::isSynced()
+{
+	return m_synced;
+}
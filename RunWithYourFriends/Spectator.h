@@ -0,0 +1,168 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include "SFML/Network.hpp"
+
+namespace spectator
+{
+	const unsigned short defaultPublisherPort{ 47100 };
+	const unsigned short defaultViewerPort{ 47101 };
+
+	//Messages a connection may have waiting before it skips ahead to the next keyframe
+	const std::size_t maxQueuedMessages{ 256 };
+
+	//What a spectator needs to draw one sprite
+	struct EntityView
+	{
+		std::uint32_t id;
+		float x;
+		float y;
+		std::uint32_t color;
+		std::uint8_t animation;
+		std::uint8_t frame;
+	};
+
+	//Everything on screen for one tick, entities sorted by id
+	struct FrameView
+	{
+		std::uint32_t tick{ 0 };
+		std::vector<float> backgroundOffsets;
+		std::vector<EntityView> entities;
+	};
+
+	//A length prefixed message, encoded once and shared by every queue that sends it
+	typedef std::shared_ptr<const std::vector<char>> Message;
+
+	Message encodeKeyframe(const FrameView& frame);
+	Message encodeDelta(const FrameView& previous, const FrameView& current);
+	bool isKeyframe(const Message& message);
+
+	//False when a delta does not follow the frame it is applied to, the frame is left as it was
+	bool applyMessage(const char* data, std::size_t size, FrameView& frame);
+
+	bool sameFrame(const FrameView& a, const FrameView& b);
+
+	//Outgoing messages for one non-blocking socket, sent in order without copying
+	class MessageQueue
+	{
+	private:
+		std::deque<Message> m_messages;
+		std::size_t m_sent{ 0 };
+
+	public:
+		void push(const Message& message);
+
+		//False once the socket is gone
+		bool flush(sf::TcpSocket& socket);
+
+		//Keeps a partly sent message so the stream stays framed
+		void dropUnsent();
+
+		std::size_t size();
+	};
+
+	//Game side, streams the tick it just simulated to a relay
+	class Broadcaster
+	{
+	private:
+		std::unique_ptr<sf::TcpSocket> m_socket;
+		MessageQueue m_queue;
+		FrameView m_previous;
+		std::string m_host;
+		unsigned short m_port{ 0 };
+		bool m_connected{ false };
+		bool m_needKeyframe{ true };
+		unsigned int m_sinceKeyframe{ 0 };
+		unsigned int m_keyframeInterval;
+		unsigned int m_sinceRetry{ 0 };
+		unsigned int m_retryInterval;
+
+		//Reconnects block on the host lookup and connect, so they run here instead of the game thread
+		std::thread m_connector;
+		std::unique_ptr<sf::TcpSocket> m_pendingSocket;
+		std::atomic<bool> m_connectDone{ false };
+		bool m_connectSucceeded{ false };
+
+		void startReconnect();
+		bool finishReconnect();
+
+	public:
+		Broadcaster(unsigned int keyframeInterval = 36, unsigned int retryInterval = 180);
+		~Broadcaster();
+
+		bool connect(const std::string& host, unsigned short port);
+		void publish(const FrameView& frame);
+
+		//After a restart the next frame has nothing in common with the last one
+		void forceKeyframe();
+
+		bool isConnected();
+	};
+
+	//Takes one publisher and fans its messages out to every viewer. Messages are forwarded as the
+	//publisher encoded them, a late joiner gets the last keyframe and the deltas since.
+	//Further publishers are turned away until the current one disconnects.
+	class Relay
+	{
+	private:
+		struct Connection
+		{
+			std::unique_ptr<sf::TcpSocket> socket;
+			MessageQueue queue;
+			bool waitingForKeyframe;
+		};
+
+		sf::TcpListener m_publisherListener;
+		sf::TcpListener m_viewerListener;
+		sf::SocketSelector m_selector;
+		std::unique_ptr<sf::TcpSocket> m_publisher;
+		std::vector<char> m_incoming;
+
+		Message m_keyframe;
+		std::vector<Message> m_deltas;
+		std::vector<Connection> m_viewers;
+		std::size_t m_maxQueued;
+		std::uint64_t m_messagesReceived{ 0 };
+
+		void acceptPublisher();
+		void acceptViewers();
+		void receivePublisher();
+		void relay(const Message& message);
+
+	public:
+		Relay(std::size_t maxQueued = maxQueuedMessages);
+
+		bool listen(unsigned short publisherPort, unsigned short viewerPort);
+
+		//Waits up to timeout for traffic, then forwards whatever arrived
+		void update(sf::Time timeout);
+
+		unsigned int getViewerCount();
+		std::uint64_t getMessagesReceived();
+	};
+
+	//Spectator side, rebuilds the publisher's frame from the relay stream
+	class Viewer
+	{
+	private:
+		sf::TcpSocket m_socket;
+		std::vector<char> m_incoming;
+		FrameView m_frame;
+		bool m_synced{ false };
+		bool m_connected{ false };
+
+	public:
+		bool connect(const std::string& host, unsigned short port);
+
+		//Reads everything waiting without blocking, false once the relay is gone
+		bool update();
+
+		const FrameView& getFrame();
+		bool isSynced();
+	};
+}
@@ -0,0 +1,225 @@
+#include "Telemetry.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <fstream>
+
+std::atomic<bool> telemetry::enabled{ false };
+
+namespace
+{
+	const std::uint32_t fileMagic{ 0x54595752 };
+	const std::uint32_t fileVersion{ 1 };
+
+	std::mutex registryMutex;
+	std::vector<std::unique_ptr<telemetry::RingBuffer>> registry;
+
+	//Drain thread only, reused so draining never allocates
+	std::vector<telemetry::RingBuffer*> drainBuffers;
+
+	thread_local telemetry::RingBuffer* threadBuffer{ nullptr };
+	thread_local std::uint32_t threadTick{ 0 };
+
+	std::chrono::steady_clock::time_point startTime;
+	std::ofstream file;
+	std::thread drainThread;
+	std::atomic<bool> draining{ false };
+
+	//Buffers are registered once per thread and only freed at exit, the drain thread may still read them
+	telemetry::RingBuffer* getThreadBuffer()
+	{
+		if (!threadBuffer)
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+			registry.push_back(std::unique_ptr<telemetry::RingBuffer>(new telemetry::RingBuffer()));
+			threadBuffer = registry.back().get();
+			threadBuffer->thread = (std::uint16_t)(registry.size() - 1);
+		}
+
+		return threadBuffer;
+	}
+
+	//Only the list of buffers is copied under the lock, a thread registering its first event
+	//never waits on the file
+	void drainAll()
+	{
+		telemetry::EventRecord records[256];
+		std::vector<telemetry::RingBuffer*>& buffers{ drainBuffers };
+
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+			buffers.clear();
+
+			for (unsigned int i{}; i < registry.size(); ++i)
+			{
+				buffers.push_back(registry[i].get());
+			}
+		}
+
+		for (unsigned int i{}; i < buffers.size(); ++i)
+		{
+			std::uint32_t count{};
+
+			while ((count = buffers[i]->pop(records, sizeof(records) / sizeof(records[0]))) > 0)
+			{
+				file.write((const char*)records, count * sizeof(records[0]));
+			}
+
+			std::uint32_t dropped{ buffers[i]->takeDropped() };
+
+			if (dropped > 0)
+			{
+				telemetry::EventRecord droppedRecord{ (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count(),
+					telemetry::EventType::Dropped, buffers[i]->thread, 0, { (float)dropped, 0, 0, 0 } };
+				file.write((const char*)&droppedRecord, sizeof(droppedRecord));
+			}
+		}
+	}
+
+	void drainLoop()
+	{
+		while (draining.load())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			drainAll();
+		}
+
+		drainAll();
+	}
+}
+
+bool telemetry::RingBuffer::push(const EventRecord& record)
+{
+	std::uint32_t head{ m_head.load(std::memory_order_relaxed) };
+
+	if (head - m_tail.load(std::memory_order_acquire) >= m_capacity)
+	{
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	m_records[head % m_capacity] = record;
+	m_head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+std::uint32_t telemetry::RingBuffer::pop(EventRecord* out, std::uint32_t maxRecords)
+{
+	std::uint32_t tail{ m_tail.load(std::memory_order_relaxed) };
+	std::uint32_t available{ m_head.load(std::memory_order_acquire) - tail };
+	std::uint32_t count{ available < maxRecords ? available : maxRecords };
+
+	for (std::uint32_t i{}; i < count; ++i)
+	{
+		out[i] = m_records[(tail + i) % m_capacity];
+	}
+
+	m_tail.store(tail + count, std::memory_order_release);
+	return count;
+}
+
+std::uint32_t telemetry::RingBuffer::takeDropped()
+{
+	return m_dropped.exchange(0, std::memory_order_relaxed);
+}
+
+bool telemetry::start(const std::string& path)
+{
+	if (enabled.load())
+	{
+		return true;
+	}
+
+	file.open(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	std::uint32_t header[3]{ fileMagic, fileVersion, (std::uint32_t)sizeof(EventRecord) };
+	file.write((const char*)header, sizeof(header));
+
+	startTime = std::chrono::steady_clock::now();
+	draining.store(true);
+	drainThread = std::thread(drainLoop);
+	enabled.store(true);
+
+	return true;
+}
+
+void telemetry::stop()
+{
+	if (!enabled.exchange(false))
+	{
+		return;
+	}
+
+	draining.store(false);
+	drainThread.join();
+	file.close();
+}
+
+void telemetry::setTick(std::uint32_t tick)
+{
+	threadTick = tick;
+}
+
+void telemetry::write(EventType type, float a, float b, float c, float d)
+{
+	RingBuffer* buffer{ getThreadBuffer() };
+	std::uint64_t timestamp{ (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count() };
+
+	buffer->push(EventRecord{ timestamp, type, buffer->thread, threadTick, { a, b, c, d } });
+}
+
+bool telemetry::decode(const std::string& path, std::ostream& out)
+{
+	std::ifstream input(path, std::ios::binary);
+	std::uint32_t header[3]{};
+
+	input.read((char*)header, sizeof(header));
+	if (!input || header[0] != fileMagic || header[1] != fileVersion || header[2] != sizeof(EventRecord))
+	{
+		return false;
+	}
+
+	const char* names[]{ "spawn", "collision", "death", "frame", "restart", "dropped" };
+	const char* fields[][4]{
+		{ "x", "y", "size", "speed" },
+		{ "player", "x", "y", "kill" },
+		{ "player", "x", "y", "alive" },
+		{ "frameMs", "logicMs", "drawMs", "visible" },
+		{ "entities", "", "", "" },
+		{ "records", "", "", "" }
+	};
+	const unsigned int typeCount{ sizeof(names) / sizeof(names[0]) };
+
+	EventRecord record;
+	while (input.read((char*)&record, sizeof(record)))
+	{
+		unsigned int type{ (unsigned int)record.type };
+
+		out << record.timestamp / 1000000.0 << "ms thread " << record.thread << " tick " << record.tick << " ";
+
+		if (type >= typeCount)
+		{
+			out << "unknown(" << type << ")\n";
+			continue;
+		}
+
+		out << names[type];
+
+		for (unsigned int i{}; i < 4; ++i)
+		{
+			if (fields[type][i][0] != '\0')
+			{
+				out << " " << fields[type][i] << "=" << record.values[i];
+			}
+		}
+		out << "\n";
+	}
+
+	return true;
+}
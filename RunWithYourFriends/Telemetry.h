@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <string>
+#include <ostream>
+
+namespace telemetry
+{
+	enum class EventType : std::uint16_t
+	{
+		Spawn,
+		Collision,
+		Death,
+		FrameStats,
+		Restart,
+		Dropped
+	};
+
+	//Fixed size binary record, the meaning of the four values depends on the type
+	struct EventRecord
+	{
+		std::uint64_t timestamp;
+		EventType type;
+		std::uint16_t thread;
+		std::uint32_t tick;
+		float values[4];
+	};
+
+	static_assert(sizeof(EventRecord) == 32, "EventRecord is written to disk as is");
+
+	//Single producer, single consumer. The owning thread pushes, the drain thread pops.
+	class RingBuffer
+	{
+	private:
+		static const std::uint32_t m_capacity{ 4096 };
+
+		EventRecord m_records[m_capacity];
+		//Padding keeps the producer and consumer indices on separate cache lines
+		char m_padHead[64];
+		std::atomic<std::uint32_t> m_head{ 0 };
+		char m_padTail[64];
+		std::atomic<std::uint32_t> m_tail{ 0 };
+		std::atomic<std::uint32_t> m_dropped{ 0 };
+
+	public:
+		std::uint16_t thread{ 0 };
+
+		bool push(const EventRecord& record);
+		std::uint32_t pop(EventRecord* out, std::uint32_t maxRecords);
+		std::uint32_t takeDropped();
+	};
+
+	extern std::atomic<bool> enabled;
+
+	bool start(const std::string& path);
+	void stop();
+
+	//Ticks are stamped per thread so callers deep in the simulation do not need to know them
+	void setTick(std::uint32_t tick);
+
+	void write(EventType type, float a, float b, float c, float d);
+
+	//Costs one relaxed load while telemetry is off
+	inline void record(EventType type, float a = 0, float b = 0, float c = 0, float d = 0)
+	{
+		if (enabled.load(std::memory_order_relaxed))
+		{
+			write(type, a, b, c, d);
+		}
+	}
+
+	bool decode(const std::string& path, std::ostream& out);
+}
@@ -0,0 +1,464 @@
+#include "TrainingEnvironment.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	//World's fixed objects, in the order World creates them
+	const LevelBox staticBoxes[]{ levelGround, levelCeiling, levelSpawnerColumn, levelKillVolume };
+	const unsigned int staticBoxCount{ sizeof(staticBoxes) / sizeof(staticBoxes[0]) };
+
+	//Same bounds as SpatialGrid::isInside
+	const float boundsLeft{ -levelBoundsMargin };
+	const float boundsRight{ levelWidth + levelBoundsMargin };
+	const float boundsTop{ -levelBoundsMargin };
+	const float boundsBottom{ levelHeight + levelBoundsMargin };
+
+	//An obstacle lives for the ticks it takes to move from the spawn point past the kill bounds
+	//at a third of its speed. The spawner waits at least minSpawnDistance / speed ticks, and never
+	//less than one, between obstacles. Older obstacles are slower than new ones, the margin covers that.
+	unsigned int obstacleCapacity(const DifficultyParameters& difficulty)
+	{
+		float travel{ (obstacleSpawnX - boundsLeft) * 3 };
+		float spacing{ std::max(1.f, std::max(difficulty.startSpeed, difficulty.minSpawnDistance)) };
+
+		return (unsigned int)std::ceil(travel / spacing * 1.5f) + 2;
+	}
+
+	//Same inclusive edge test as CollisionHandler::checkAxis
+	bool axisOverlaps(float currentMin, float currentSize, float checkMin, float checkSize)
+	{
+		float currentMax{ currentMin + currentSize };
+		float checkMax{ checkMin + checkSize };
+
+		return (currentMin >= checkMin && currentMin <= checkMax) || (currentMax >= checkMin && currentMax <= checkMax);
+	}
+
+	std::uint32_t mixSeed(std::uint32_t seed, std::uint32_t env, std::uint32_t episode)
+	{
+		std::uint32_t hash{ seed ^ (env * 0x9E3779B9u) ^ (episode * 0x85EBCA6Bu) };
+		hash ^= hash >> 16;
+		hash *= 0x7FEB352Du;
+		hash ^= hash >> 15;
+		hash *= 0x846CA68Bu;
+		hash ^= hash >> 16;
+
+		return hash ? hash : 1;
+	}
+}
+
+training::BatchEnvironment::BatchEnvironment(unsigned int envCount, unsigned int threadCount, DifficultyParameters difficulty, std::uint32_t seed) :
+	m_envCount{ envCount }, m_difficulty{ difficulty }, m_seed{ seed },
+	m_playerX(envCount), m_playerY(envCount), m_lastX(envCount), m_lastY(envCount), m_forceX(envCount), m_forceY(envCount), m_onGround(envCount),
+	m_pixelSpeed(envCount), m_lastSpawn(envCount), m_random(envCount), m_obstacleCapacity{ obstacleCapacity(difficulty) },
+	m_obstacleX(envCount * m_obstacleCapacity), m_obstacleY(envCount * m_obstacleCapacity), m_obstacleWidth(envCount * m_obstacleCapacity),
+	m_obstacleHeight(envCount * m_obstacleCapacity), m_obstacleSpeed(envCount * m_obstacleCapacity), m_obstacleCount(envCount), m_droppedObstacles(envCount),
+	m_episodeTicks(envCount), m_episodeCount(envCount), m_finishedTicks(envCount)
+{
+	for (unsigned int env{}; env < m_envCount; ++env)
+	{
+		resetEnvironment(env);
+	}
+
+	threadCount = std::max(1u, std::min(threadCount, m_envCount));
+
+	for (unsigned int slice{ 1 }; slice < threadCount; ++slice)
+	{
+		m_workers.push_back(std::thread(&BatchEnvironment::workerLoop, this, slice));
+	}
+}
+
+training::BatchEnvironment::~BatchEnvironment()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_startStep.notify_all();
+
+	for (unsigned int i{}; i < m_workers.size(); ++i)
+	{
+		m_workers[i].join();
+	}
+}
+
+void training::BatchEnvironment::resetEnvironment(unsigned int env)
+{
+	m_playerX[env] = playerStartX;
+	m_playerY[env] = playerStartY;
+	m_lastX[env] = playerStartX;
+	m_lastY[env] = playerStartY;
+	m_forceX[env] = 0;
+	m_forceY[env] = 0;
+	m_onGround[env] = 0;
+
+	m_pixelSpeed[env] = m_difficulty.startSpeed;
+	m_lastSpawn[env] = 0;
+	m_random[env] = mixSeed(m_seed, env, m_episodeCount[env]);
+
+	m_obstacleCount[env] = 0;
+	m_episodeTicks[env] = 0;
+}
+
+//One contact from Character::checkCollision
+void training::BatchEnvironment::resolveHit(unsigned int env, float left, float top, float width, float height)
+{
+	float distanceX{ m_lastX[env] - left };
+	float distanceY{ m_lastY[env] - top };
+	float selfMin{ m_lastY[env] };
+	float selfMax{ m_lastY[env] + playerSize };
+	float colMin{ top };
+	float colMax{ top + height };
+
+	if ((selfMax > colMin) && (selfMin < colMax))
+	{
+		m_forceX[env] = 0;
+		m_playerX[env] = distanceX < 0 ? left - playerSize - 1 : left + width + 1;
+	}
+	else if (distanceY < 0)
+	{
+		m_playerY[env] = top - playerSize;
+		m_onGround[env] = 1;
+
+		if (m_forceY[env] > 0)
+		{
+			m_forceY[env] = 0;
+		}
+	}
+	else
+	{
+		m_playerY[env] = top + height + 1;
+
+		if (m_forceY[env] < 0)
+		{
+			m_forceY[env] = 0;
+		}
+	}
+}
+
+//Character::checkCollision against everything CollisionHandler reports, returns true on a kill.
+//Overlaps are tested at the position before any push, so resolving each hit as it is found
+//matches the game collecting them first.
+bool training::BatchEnvironment::collide(unsigned int env)
+{
+	const unsigned int base{ env * m_obstacleCapacity };
+	bool killed{ false };
+
+	float x{ m_playerX[env] };
+	float y{ m_playerY[env] };
+
+	m_onGround[env] = 0;
+
+	for (unsigned int i{}; i < staticBoxCount; ++i)
+	{
+		const LevelBox& box{ staticBoxes[i] };
+
+		if (axisOverlaps(x, playerSize, box.left, box.width) && axisOverlaps(y, playerSize, box.top, box.height))
+		{
+			killed = killed || box.isKill;
+			resolveHit(env, box.left, box.top, box.width, box.height);
+		}
+	}
+
+	for (unsigned int i{ base }; i < base + m_obstacleCount[env]; ++i)
+	{
+		if (axisOverlaps(x, playerSize, m_obstacleX[i], m_obstacleWidth[i]) && axisOverlaps(y, playerSize, m_obstacleY[i], m_obstacleHeight[i]))
+		{
+			resolveHit(env, m_obstacleX[i], m_obstacleY[i], m_obstacleWidth[i], m_obstacleHeight[i]);
+		}
+	}
+
+	return killed;
+}
+
+//ObstacleSpawner::logicTick
+void training::BatchEnvironment::spawn(unsigned int env)
+{
+	Random random{ m_random[env] };
+
+	m_pixelSpeed[env] += m_difficulty.speedIncrease;
+
+	int percChance{ (int)(random.next() % 100) };
+
+	if ((percChance >= 100 - m_difficulty.spawnChance) && (++m_lastSpawn[env] > m_difficulty.minSpawnDistance / m_pixelSpeed[env]))
+	{
+		int isLargeBox{ (int)(random.next() % 100) };
+		float y{ obstacleSpawnY - 20 };
+		float size{ 20 };
+
+		if (isLargeBox < m_difficulty.rockChance)
+		{
+			y = obstacleSpawnY;
+			size = 30;
+		}
+		else if (isLargeBox < m_difficulty.rockChance + m_difficulty.stumpChance)
+		{
+			y = obstacleSpawnY + 10;
+		}
+
+		if (m_obstacleCount[env] < m_obstacleCapacity)
+		{
+			unsigned int slot{ env * m_obstacleCapacity + m_obstacleCount[env]++ };
+
+			m_obstacleX[slot] = obstacleSpawnX;
+			m_obstacleY[slot] = y;
+			m_obstacleWidth[slot] = size;
+			m_obstacleHeight[slot] = size;
+			m_obstacleSpeed[slot] = m_pixelSpeed[env];
+		}
+		else
+		{
+			++m_droppedObstacles[env];
+		}
+		m_lastSpawn[env] = 0;
+	}
+
+	m_random[env] = random.state;
+}
+
+//One World::logicTick for a single player world
+void training::BatchEnvironment::stepEnvironment(unsigned int env)
+{
+	std::uint8_t input{ m_inputs[env] };
+	bool killed{ collide(env) };
+
+	spawn(env);
+
+	//Obstacle::logicTick, then drop whatever left the kill bounds keeping spawn order
+	const unsigned int base{ env * m_obstacleCapacity };
+	unsigned int kept{ base };
+
+	for (unsigned int i{ base }; i < base + m_obstacleCount[env]; ++i)
+	{
+		m_obstacleX[i] += m_obstacleSpeed[i] * -1 / 3;
+
+		if (m_obstacleX[i] >= boundsLeft && m_obstacleX[i] <= boundsRight)
+		{
+			m_obstacleX[kept] = m_obstacleX[i];
+			m_obstacleY[kept] = m_obstacleY[i];
+			m_obstacleWidth[kept] = m_obstacleWidth[i];
+			m_obstacleHeight[kept] = m_obstacleHeight[i];
+			m_obstacleSpeed[kept] = m_obstacleSpeed[i];
+			++kept;
+		}
+	}
+	m_obstacleCount[env] = kept - base;
+
+	//Character::logicTick, a player killed in collision does not move again
+	if (!killed)
+	{
+		if (input & InputRight)
+		{
+			m_forceX[env] += characterMovementSpeed;
+		}
+
+		if (input & InputLeft)
+		{
+			m_forceX[env] += characterMovementSpeed * -1;
+		}
+
+		m_forceY[env] += gravity * characterGravityModifier;
+		m_lastX[env] = m_playerX[env];
+		m_lastY[env] = m_playerY[env];
+		m_playerX[env] += m_forceX[env];
+		m_playerY[env] += m_forceY[env];
+
+		if (m_onGround[env])
+		{
+			m_forceX[env] *= characterGroundResistance;
+
+			if (input & InputJump)
+			{
+				m_forceY[env] += -characterJumpForce;
+			}
+		}
+		else
+		{
+			m_forceX[env] *= characterAirResistance;
+		}
+
+		float x{ m_playerX[env] };
+		float y{ m_playerY[env] };
+		killed = x < boundsLeft || x > boundsRight || y < boundsTop || y > boundsBottom;
+	}
+
+	++m_episodeTicks[env];
+	m_rewards[env] = killed ? 0.f : 1.f;
+	m_dones[env] = killed ? 1 : 0;
+
+	if (killed)
+	{
+		m_finishedTicks[env] += m_episodeTicks[env];
+		++m_episodeCount[env];
+		resetEnvironment(env);
+	}
+
+	observe(env, m_observations + env * observationSize);
+}
+
+void training::BatchEnvironment::observe(unsigned int env, float* observation)
+{
+	const unsigned int base{ env * m_obstacleCapacity };
+	float x{ m_playerX[env] };
+
+	observation[0] = m_playerY[env] / levelHeight;
+	observation[1] = x / levelWidth;
+	observation[2] = m_forceY[env];
+	observation[3] = m_forceX[env];
+	observation[4] = m_onGround[env];
+	observation[5] = m_pixelSpeed[env];
+	observation[6] = 1;
+	observation[7] = 0;
+	observation[8] = 0;
+	observation[9] = 0;
+
+	//Obstacles are in spawn order so the first one not yet passed is the next one ahead
+	for (unsigned int i{ base }; i < base + m_obstacleCount[env]; ++i)
+	{
+		if (m_obstacleX[i] + m_obstacleWidth[i] >= x)
+		{
+			observation[6] = (m_obstacleX[i] - x) / levelWidth;
+			observation[7] = m_obstacleY[i] / levelHeight;
+			observation[8] = m_obstacleWidth[i] / 30;
+			observation[9] = m_obstacleHeight[i] / 30;
+			break;
+		}
+	}
+}
+
+void training::BatchEnvironment::stepSlice(unsigned int slice)
+{
+	unsigned int sliceCount{ (unsigned int)m_workers.size() + 1 };
+	unsigned int begin{ m_envCount * slice / sliceCount };
+	unsigned int end{ m_envCount * (slice + 1) / sliceCount };
+
+	for (unsigned int env{ begin }; env < end; ++env)
+	{
+		stepEnvironment(env);
+	}
+}
+
+void training::BatchEnvironment::workerLoop(unsigned int slice)
+{
+	unsigned int seenGeneration{ 0 };
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_startStep.wait(lock, [&] { return m_generation != seenGeneration || m_stopping; });
+
+			if (m_stopping)
+			{
+				return;
+			}
+			seenGeneration = m_generation;
+		}
+
+		stepSlice(slice);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_workersDone;
+		}
+		m_stepDone.notify_one();
+	}
+}
+
+void training::BatchEnvironment::reset(float* observations)
+{
+	for (unsigned int env{}; env < m_envCount; ++env)
+	{
+		resetEnvironment(env);
+		observe(env, observations + env * observationSize);
+	}
+}
+
+void training::BatchEnvironment::step(const std::uint8_t* inputs, float* observations, float* rewards, std::uint8_t* dones)
+{
+	m_inputs = inputs;
+	m_observations = observations;
+	m_rewards = rewards;
+	m_dones = dones;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_workersDone = 0;
+		++m_generation;
+	}
+	m_startStep.notify_all();
+
+	stepSlice(0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_stepDone.wait(lock, [this] { return m_workersDone == m_workers.size(); });
+}
+
+unsigned int training::BatchEnvironment::getEnvironmentCount()
+{
+	return m_envCount;
+}
+
+std::uint64_t training::BatchEnvironment::getFinishedEpisodes()
+{
+	std::uint64_t episodes{};
+
+	for (unsigned int env{}; env < m_envCount; ++env)
+	{
+		episodes += m_episodeCount[env];
+	}
+
+	return episodes;
+}
+
+double training::BatchEnvironment::getMeanEpisodeLength()
+{
+	std::uint64_t ticks{};
+
+	for (unsigned int env{}; env < m_envCount; ++env)
+	{
+		ticks += m_finishedTicks[env];
+	}
+
+	std::uint64_t episodes{ getFinishedEpisodes() };
+	return episodes ? (double)ticks / episodes : 0;
+}
+
+std::uint64_t training::BatchEnvironment::getDroppedObstacles()
+{
+	std::uint64_t dropped{};
+
+	for (unsigned int env{}; env < m_envCount; ++env)
+	{
+		dropped += m_droppedObstacles[env];
+	}
+
+	return dropped;
+}
+
+void training::BatchEnvironment::setRandomState(unsigned int env, std::uint32_t state)
+{
+	m_random[env] = state ? state : 1;
+}
+
+void training::BatchEnvironment::getState(unsigned int env, EnvironmentState& state)
+{
+	const unsigned int base{ env * m_obstacleCapacity };
+
+	state.playerX = m_playerX[env];
+	state.playerY = m_playerY[env];
+	state.lastX = m_lastX[env];
+	state.lastY = m_lastY[env];
+	state.forceX = m_forceX[env];
+	state.forceY = m_forceY[env];
+	state.onGround = m_onGround[env] != 0;
+	state.pixelSpeed = m_pixelSpeed[env];
+	state.lastSpawn = m_lastSpawn[env];
+	state.randomState = m_random[env];
+
+	state.obstacles.resize(m_obstacleCount[env]);
+	for (unsigned int i{}; i < m_obstacleCount[env]; ++i)
+	{
+		state.obstacles[i] = ObstacleState{ m_obstacleX[base + i], m_obstacleY[base + i], m_obstacleWidth[base + i], m_obstacleHeight[base + i], m_obstacleSpeed[base + i] };
+	}
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "SimulationRules.h"
+
+namespace training
+{
+	//Player y, x, vertical force, horizontal force, on ground, obstacle speed,
+	//then distance, top, width and height of the next obstacle ahead
+	const unsigned int observationSize{ 10 };
+
+	struct ObstacleState
+	{
+		float x;
+		float y;
+		float width;
+		float height;
+		float speed;
+	};
+
+	//Everything one environment carries from tick to tick, read back to check it against World
+	struct EnvironmentState
+	{
+		float playerX;
+		float playerY;
+		float lastX;
+		float lastY;
+		float forceX;
+		float forceY;
+		bool onGround;
+		float pixelSpeed;
+		int lastSpawn;
+		std::uint32_t randomState;
+		std::vector<ObstacleState> obstacles;
+	};
+
+	//Steps many single player copies of the game in lockstep without SFML. State lives in
+	//one array per field so a worker walks straight through memory for its slice of environments.
+	//Player physics mirror Character and spawning mirrors ObstacleSpawner, tick for tick.
+	class BatchEnvironment
+	{
+	private:
+		unsigned int m_envCount;
+		DifficultyParameters m_difficulty;
+		std::uint32_t m_seed;
+
+		//Player, one entry per environment
+		std::vector<float> m_playerX;
+		std::vector<float> m_playerY;
+		std::vector<float> m_lastX;
+		std::vector<float> m_lastY;
+		std::vector<float> m_forceX;
+		std::vector<float> m_forceY;
+		std::vector<std::uint8_t> m_onGround;
+
+		//Spawner, one entry per environment
+		std::vector<float> m_pixelSpeed;
+		std::vector<int> m_lastSpawn;
+		std::vector<std::uint32_t> m_random;
+
+		//Obstacles, m_obstacleCapacity slots per environment kept in spawn order. The capacity
+		//is worked out from the difficulty, anything spawned past it is counted in m_droppedObstacles.
+		unsigned int m_obstacleCapacity;
+		std::vector<float> m_obstacleX;
+		std::vector<float> m_obstacleY;
+		std::vector<float> m_obstacleWidth;
+		std::vector<float> m_obstacleHeight;
+		std::vector<float> m_obstacleSpeed;
+		std::vector<unsigned int> m_obstacleCount;
+		std::vector<std::uint64_t> m_droppedObstacles;
+
+		//Per environment so workers never share a counter
+		std::vector<unsigned int> m_episodeTicks;
+		std::vector<unsigned int> m_episodeCount;
+		std::vector<std::uint64_t> m_finishedTicks;
+
+		//Workers take equal slices, the calling thread steps the first one itself
+		std::vector<std::thread> m_workers;
+		std::mutex m_mutex;
+		std::condition_variable m_startStep;
+		std::condition_variable m_stepDone;
+		unsigned int m_generation{ 0 };
+		unsigned int m_workersDone{ 0 };
+		bool m_stopping{ false };
+
+		const std::uint8_t* m_inputs{ nullptr };
+		float* m_observations{ nullptr };
+		float* m_rewards{ nullptr };
+		std::uint8_t* m_dones{ nullptr };
+
+		void resetEnvironment(unsigned int env);
+		void resolveHit(unsigned int env, float left, float top, float width, float height);
+		bool collide(unsigned int env);
+		void spawn(unsigned int env);
+		void stepEnvironment(unsigned int env);
+		void observe(unsigned int env, float* observation);
+		void stepSlice(unsigned int slice);
+		void workerLoop(unsigned int slice);
+
+	public:
+		BatchEnvironment(unsigned int envCount, unsigned int threadCount, DifficultyParameters difficulty, std::uint32_t seed);
+		~BatchEnvironment();
+
+		void reset(float* observations);
+
+		//inputs holds one InputBits byte per environment. Finished environments restart
+		//on their own so the batch never stalls, their observation is already the new episode.
+		void step(const std::uint8_t* inputs, float* observations, float* rewards, std::uint8_t* dones);
+
+		unsigned int getEnvironmentCount();
+		std::uint64_t getFinishedEpisodes();
+		double getMeanEpisodeLength();
+
+		//Non zero means the run no longer matches the game, the capacity estimate was too small
+		std::uint64_t getDroppedObstacles();
+
+		//Replaces the mixed seed of the running episode so it can start from a World's exact
+		//random state. Later episodes of that environment are seeded as usual.
+		void setRandomState(unsigned int env, std::uint32_t state);
+		void getState(unsigned int env, EnvironmentState& state);
+	};
+}
@@ -4,57 +4,318 @@
 #include <cmath>
 #include <time.h>
 #include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <cstdlib>
+#include <functional>
 
 #include "SFML/Graphics.hpp"
 #include "SFML/Audio.hpp"
 
+#include "FrameCapture.h"
+#include "SimulationRules.h"
+#include "TrainingEnvironment.h"
+#include "Telemetry.h"
+#include "Spectator.h"
+
 #define DEBUG 0
 
 #if DEBUG
-#define LOG(x) std::cout << x << std::endl
+//Console output for debugging only, events worth keeping go through telemetry
+#define LOG(x) std::cout << x << '\n'
 #else
 #define LOG(x)
 #endif
 
-const float gravity{9.8};
+enum AnimationId : unsigned char
+{
+	PlayerRunAnim,
+	RockAnim,
+	StumpAnim,
+	TreeAnim,
+	MachineAnim,
+	EmptyAnim,
+	AnimationCount
+};
 
 struct Animation
 {
 	sf::Texture& texture;
 	unsigned int frames;
 	bool textureLoaded;
+	AnimationId id;
+};
+
+enum class ObjectType : unsigned char
+{
+	Ground,
+	Character,
+	Obstacle,
+	ObstacleSpawner
+};
+
+//Plain copy of one object, everything needed to rebuild it
+struct EntityState
+{
+	ObjectType type;
+	AnimationId animation;
+	unsigned int currentFrame;
+	bool kill;
+	bool collisionIsKill;
+	sf::Vector2f location;
+	sf::Vector2f collisionSize;
+	sf::Vector2f collisionRelativeLocation;
+
+	//Character
+	unsigned int playerSlot;
+	sf::Vector2f lastPosition;
+	sf::Vector2f force;
+	bool onGround;
+	bool movingRight;
+	bool movingLeft;
+	bool jumping;
+
+	//Obstacle speed, spawner pixel speed
+	float speed;
+
+	//ObstacleSpawner
+	int lastSpawn;
+	sf::Vector2f spawnLocation;
+};
+
+const unsigned int maxPlayers{ 8 };
+
+const unsigned int maxBackgroundLayers{ 4 };
+
+//Background.png is split from this row down, where the grass tufts start. Only grass and dirt
+//pixels move to the ground layer, the hills keep their own pixels down to where the grass covers them.
+const unsigned int backgroundGroundRow{ 145 };
+
+//The ground layer keeps pace with the obstacles, everything behind it drifts at this fraction
+const float backgroundFarScroll{ 0.5 };
+
+const unsigned int maxSnapshotEntities{ 64 };
+
+//Fixed size copy of the whole simulation, restoring it is a restart
+struct SimulationSnapshot
+{
+	unsigned int staticCount;
+	unsigned int dynamicCount;
+	EntityState entities[maxSnapshotEntities];
+	float backgroundSpeed;
+	float backgroundOffsets[maxBackgroundLayers];
+	std::uint32_t randomState;
+	unsigned int frameCount;
+
+	//Snapshots read from disk are checked before anything indexes with them
+	bool isValid() const
+	{
+		if (staticCount > maxSnapshotEntities || dynamicCount > maxSnapshotEntities - staticCount || randomState == 0)
+		{
+			return false;
+		}
+
+		for (unsigned int i{}; i < staticCount + dynamicCount; ++i)
+		{
+			if ((unsigned int)entities[i].type > (unsigned int)ObjectType::ObstacleSpawner || (unsigned int)entities[i].animation >= AnimationCount)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
+
+//Composites every layer in one full screen pass. Each pixel samples the layers back to
+//front at its own wrapped scroll offset and blends them by alpha.
+const std::string backgroundShaderSource{ R"(
+uniform sampler2D layer0;
+uniform sampler2D layer1;
+uniform sampler2D layer2;
+uniform sampler2D layer3;
+uniform vec4 offsets;
+uniform vec4 widths;
+uniform vec4 heights;
+uniform float layerCount;
+
+vec4 sampleLayer(sampler2D layer, vec2 pixel, float offset, float width, float height)
+{
+	return texture2D(layer, vec2(mod(pixel.x + offset, width) / width, pixel.y / height));
+}
+
+void main()
+{
+	vec2 pixel = floor(gl_TexCoord[0].xy) + 0.5;
+	vec4 color = sampleLayer(layer0, pixel, offsets.x, widths.x, heights.x);
+
+	if (layerCount > 1.5)
+	{
+		vec4 layer = sampleLayer(layer1, pixel, offsets.y, widths.y, heights.y);
+		color.rgb = mix(color.rgb, layer.rgb, layer.a);
+	}
+
+	if (layerCount > 2.5)
+	{
+		vec4 layer = sampleLayer(layer2, pixel, offsets.z, widths.z, heights.z);
+		color.rgb = mix(color.rgb, layer.rgb, layer.a);
+	}
+
+	if (layerCount > 3.5)
+	{
+		vec4 layer = sampleLayer(layer3, pixel, offsets.w, widths.w, heights.w);
+		color.rgb = mix(color.rgb, layer.rgb, layer.a);
+	}
+
+	gl_FragColor = vec4(color.rgb, 1.0);
+}
+)" };
+
+struct BackgroundLayer
+{
+	sf::Texture* texture;
+	float scrollFactor;
+	float offset;
 };
 
+//Layers are added back to front, a scroll factor below 1 makes a layer feel further away.
+//Offsets are wrapped to the texture width every tick so they never lose precision.
 class Background
 {
 private:
-	sf::Sprite m_backgroundImage;
+	BackgroundLayer m_layers[maxBackgroundLayers]{};
+	unsigned int m_layerCount{ 0 };
 	float m_speed{ 0 };
-	float m_position{};
+	sf::Vector2f m_size;
+
+	sf::Shader m_shader;
+	bool m_useShader{ false };
+	sf::VertexArray m_quad{ sf::Quads, 4 };
+	sf::Sprite m_fallbackSprite;
+
+	void updateUniforms()
+	{
+		float offsets[maxBackgroundLayers]{};
+
+		for (unsigned int i{}; i < m_layerCount; ++i)
+		{
+			offsets[i] = std::floor(m_layers[i].offset);
+		}
+
+		m_shader.setUniform("offsets", sf::Glsl::Vec4(offsets[0], offsets[1], offsets[2], offsets[3]));
+	}
 
 public:
-	Background(sf::Texture& texture)
+	Background(sf::Texture& texture, sf::Vector2f size, float scrollFactor = 1) : m_size{ size }
+	{
+		m_quad[0] = sf::Vertex(sf::Vector2f(0, 0), sf::Vector2f(0, 0));
+		m_quad[1] = sf::Vertex(sf::Vector2f(size.x, 0), sf::Vector2f(size.x, 0));
+		m_quad[2] = sf::Vertex(sf::Vector2f(size.x, size.y), sf::Vector2f(size.x, size.y));
+		m_quad[3] = sf::Vertex(sf::Vector2f(0, size.y), sf::Vector2f(0, size.y));
+
+		m_useShader = sf::Shader::isAvailable() && m_shader.loadFromMemory(backgroundShaderSource, sf::Shader::Fragment);
+
+		addLayer(texture, scrollFactor);
+	}
+
+	bool addLayer(sf::Texture& texture, float scrollFactor)
 	{
+		if (m_layerCount >= maxBackgroundLayers)
+		{
+			return false;
+		}
+
 		texture.setRepeated(true);
-		m_backgroundImage.setTexture(texture);
+		m_layers[m_layerCount++] = BackgroundLayer{ &texture, scrollFactor, 0 };
+
+		if (m_useShader)
+		{
+			float widths[maxBackgroundLayers]{ 1, 1, 1, 1 };
+			float heights[maxBackgroundLayers]{ 1, 1, 1, 1 };
+
+			//Unused samplers point at the first layer so every sampler is valid
+			for (unsigned int i{}; i < maxBackgroundLayers; ++i)
+			{
+				BackgroundLayer& layer{ m_layers[i < m_layerCount ? i : 0] };
+
+				m_shader.setUniform("layer" + std::to_string(i), *layer.texture);
+				widths[i] = layer.texture->getSize().x;
+				heights[i] = layer.texture->getSize().y;
+			}
+
+			m_shader.setUniform("widths", sf::Glsl::Vec4(widths[0], widths[1], widths[2], widths[3]));
+			m_shader.setUniform("heights", sf::Glsl::Vec4(heights[0], heights[1], heights[2], heights[3]));
+			m_shader.setUniform("layerCount", (float)m_layerCount);
+			updateUniforms();
+		}
+
+		return true;
 	}
 
 	void draw(sf::RenderTexture& texture)
 	{
-		texture.draw(m_backgroundImage);
+		if (m_useShader)
+		{
+			texture.draw(m_quad, &m_shader);
+			return;
+		}
+
+		for (unsigned int i{}; i < m_layerCount; ++i)
+		{
+			m_fallbackSprite.setTexture(*m_layers[i].texture);
+			m_fallbackSprite.setTextureRect(sf::IntRect((int)m_layers[i].offset, 0, (int)m_size.x, (int)m_size.y));
+			texture.draw(m_fallbackSprite);
+		}
 	}
 
 	void tick()
 	{
 		m_speed += 0.001;
-		m_position += m_speed;
 
-		unsigned int
-			left{ (unsigned int)m_position },
-			up{ 0 },
-			width{ m_backgroundImage.getTexture()->getSize().x },
-			height{ m_backgroundImage.getTexture()->getSize().x };
-		m_backgroundImage.setTextureRect(sf::IntRect(left, up, width, height));
+		for (unsigned int i{}; i < m_layerCount; ++i)
+		{
+			float width{ (float)m_layers[i].texture->getSize().x };
+
+			m_layers[i].offset = std::fmod(m_layers[i].offset + m_speed * m_layers[i].scrollFactor, width);
+		}
+
+		if (m_useShader)
+		{
+			updateUniforms();
+		}
+	}
+
+	float getSpeed()
+	{
+		return m_speed;
+	}
+
+	float getOffset(unsigned int layer)
+	{
+		return m_layers[layer].offset;
+	}
+
+	unsigned int getLayerCount()
+	{
+		return m_layerCount;
+	}
+
+	void setState(float speed, const float* offsets)
+	{
+		m_speed = speed;
+
+		for (unsigned int i{}; i < m_layerCount; ++i)
+		{
+			m_layers[i].offset = offsets[i];
+		}
+
+		if (m_useShader)
+		{
+			updateUniforms();
+		}
 	}
 };
 
@@ -74,8 +335,6 @@ private:
 			width{ tileSize },
 			height{ m_currentAnimation->texture.getSize().y };
 
-		LOG(m_currentFrame);
-
 		return sf::IntRect(left, up, width, height);
 	}
 
@@ -120,6 +379,81 @@ public:
 	{
 		return m_sprite;
 	}
+
+	Animation* getAnimation()
+	{
+		return m_currentAnimation;
+	}
+
+	unsigned int getCurrentFrame()
+	{
+		return m_currentFrame;
+	}
+
+	void setState(Animation* anim, unsigned int frame)
+	{
+		m_currentAnimation = anim;
+		m_currentFrame = frame;
+		if (m_currentAnimation->textureLoaded)
+		{
+			m_sprite.setTexture(anim->texture);
+			m_sprite.setTextureRect(getRect());
+		}
+	}
+};
+
+//Collects debug geometry for a frame into one vertex buffer, drawn with a single call
+class DebugDraw
+{
+private:
+	sf::VertexArray m_vertices{ sf::Lines };
+	bool m_enabled{ DEBUG != 0 };
+
+public:
+	void addLine(sf::Vector2f start, sf::Vector2f end, sf::Color color)
+	{
+		m_vertices.append(sf::Vertex(start, color));
+		m_vertices.append(sf::Vertex(end, color));
+	}
+
+	void addBox(sf::FloatRect rect, sf::Color color)
+	{
+		sf::Vector2f
+			topLeft{ rect.left, rect.top },
+			topRight{ rect.left + rect.width, rect.top },
+			bottomRight{ rect.left + rect.width, rect.top + rect.height },
+			bottomLeft{ rect.left, rect.top + rect.height };
+
+		addLine(topLeft, topRight, color);
+		addLine(topRight, bottomRight, color);
+		addLine(bottomRight, bottomLeft, color);
+		addLine(bottomLeft, topLeft, color);
+	}
+
+	void addVector(sf::Vector2f origin, sf::Vector2f vector, sf::Color color)
+	{
+		addLine(origin, origin + vector, color);
+	}
+
+	void draw(sf::RenderTexture& texture)
+	{
+		if (m_vertices.getVertexCount() > 0)
+		{
+			texture.draw(m_vertices);
+		}
+		m_vertices.clear();
+	}
+
+	bool isEnabled()
+	{
+		return m_enabled;
+	}
+
+	void toggle()
+	{
+		m_enabled = !m_enabled;
+		m_vertices.clear();
+	}
 };
 
 class Collision
@@ -129,6 +463,7 @@ private:
 	sf::Vector2f m_size{};
 	sf::Vertex m_lines[8];
 	bool m_isKill{ false };
+	bool m_isColliding{ false };
 
 public:
 	Collision() = default;
@@ -145,9 +480,9 @@ public:
 		m_relativeLocation = newRelativeLocation;
 	}
 
-	void drawCollision(sf::RenderTexture& texture)
+	void drawCollision(DebugDraw& debugDraw)
 	{
-		texture.draw(m_lines, 8, sf::Lines);
+		debugDraw.addBox(getBounds(), m_isColliding ? sf::Color::Red : sf::Color::White);
 	}
 
 	void updateCollision(sf::Vector2f parentLocation)
@@ -167,19 +502,9 @@ public:
 		m_lines[7].position = sf::Vector2f(tempLocation.x, tempLocation.y);
 	}
 
-	void setColor(bool isColliding)
+	void setIsColliding(bool isColliding)
 	{
-		for (unsigned int i{}; i < sizeof(m_lines) / sizeof(m_lines[0]); ++i)
-		{
-			if (isColliding)
-			{
-				m_lines[i].color = sf::Color::Red;
-			}
-			else
-			{
-				m_lines[i].color = sf::Color::White;
-			}
-		}
+		m_isColliding = isColliding;
 	}
 
 	sf::Vertex* getLines()
@@ -192,6 +517,16 @@ public:
 		return m_size;
 	}
 
+	sf::Vector2f getRelativeLocation()
+	{
+		return m_relativeLocation;
+	}
+
+	sf::FloatRect getBounds()
+	{
+		return sf::FloatRect(m_lines[0].position, m_size);
+	}
+
 	bool getIsKill()
 	{
 		return m_isKill;
@@ -203,13 +538,65 @@ public:
 	}
 };
 
+//Collects consecutive sprites sharing a texture into one quad array, so extra players or
+//obstacles of the same kind cost vertices rather than draw calls
+class SpriteBatch
+{
+private:
+	sf::VertexArray m_vertices{ sf::Quads };
+	const sf::Texture* m_texture{ nullptr };
+
+public:
+	void add(sf::Sprite& sprite, sf::RenderTexture& texture)
+	{
+		if (sprite.getTexture() != m_texture)
+		{
+			flush(texture);
+			m_texture = sprite.getTexture();
+		}
+
+		sf::Vector2f position{ sprite.getPosition() };
+		sf::IntRect rect{ sprite.getTextureRect() };
+		sf::Color color{ sprite.getColor() };
+
+		float
+			left{ (float)rect.left },
+			top{ (float)rect.top },
+			right{ (float)(rect.left + rect.width) },
+			bottom{ (float)(rect.top + rect.height) };
+
+		m_vertices.append(sf::Vertex(position, color, sf::Vector2f(left, top)));
+		m_vertices.append(sf::Vertex(position + sf::Vector2f(rect.width, 0), color, sf::Vector2f(right, top)));
+		m_vertices.append(sf::Vertex(position + sf::Vector2f(rect.width, rect.height), color, sf::Vector2f(right, bottom)));
+		m_vertices.append(sf::Vertex(position + sf::Vector2f(0, rect.height), color, sf::Vector2f(left, bottom)));
+	}
+
+	void flush(sf::RenderTexture& texture)
+	{
+		if (m_vertices.getVertexCount() > 0)
+		{
+			texture.draw(m_vertices, sf::RenderStates(m_texture));
+		}
+		m_vertices.clear();
+	}
+};
+
 class GameObject
 {
+private:
+	//Never reused, spectators match objects across ticks by it
+	static std::uint32_t nextEntityId()
+	{
+		static std::uint32_t next{ 0 };
+		return ++next;
+	}
+
 protected:
 	sf::Vector2f m_location;
 	Collision m_collision;
 	AnimationComponent m_animComp;
 	bool m_kill{ false };
+	std::uint32_t m_entityId{ nextEntityId() };
 
 public:
 	GameObject() = default;
@@ -217,28 +604,51 @@ public:
 		m_location{ startLocation }, m_animComp{ startAnim }
 	{
 		m_collision.setupCollision(collisionSize, collisionRelativeLocation, startLocation);
+		m_animComp.getSprite().setPosition(startLocation);
 	}
 
+	virtual ~GameObject() = default;
+
+	virtual ObjectType getType() = 0;
+
 	virtual void logicTick()
 	{
 		m_collision.updateCollision(m_location);
 	}
 
-	virtual void graphicTick(sf::RenderTexture& texture)
+	virtual void graphicTick()
 	{
 		m_animComp.update();
 		m_animComp.getSprite().setPosition(m_location);
 		//texture.draw(m_animComp.getSprite());
 	}
 
-	void drawObject(sf::RenderTexture& texture)
+	//Movement is shown every tick, animation frames only advance on graphic ticks
+	void syncSprite()
 	{
-		texture.draw(m_animComp.getSprite());
+		m_animComp.getSprite().setPosition(m_location);
+	}
 
-		if (DEBUG)
-		{
-			m_collision.drawCollision(texture);
-		}
+	void drawObject(SpriteBatch& batch, sf::RenderTexture& texture)
+	{
+		batch.add(m_animComp.getSprite(), texture);
+	}
+
+	virtual void drawDebug(DebugDraw& debugDraw)
+	{
+		m_collision.drawCollision(debugDraw);
+	}
+
+	//Objects without a texture (spawner, ground) never produce pixels
+	bool isDrawable()
+	{
+		return m_animComp.getAnimation()->textureLoaded;
+	}
+
+	sf::FloatRect getSpriteBounds()
+	{
+		sf::IntRect rect{ m_animComp.getSprite().getTextureRect() };
+		return sf::FloatRect(m_location.x, m_location.y, rect.width, rect.height);
 	}
 
 	void setLocation(sf::Vector2f newLocation)
@@ -259,14 +669,7 @@ public:
 	virtual void checkCollision(std::vector<GameObject*> collidedObjects)
 	{
 
-		if (!collidedObjects.empty())
-		{
-			m_collision.setColor(true);
-		}
-		else
-		{
-			m_collision.setColor(false);
-		}
+		m_collision.setIsColliding(!collidedObjects.empty());
 	}
 
 	Collision* getCollision()
@@ -288,6 +691,38 @@ public:
 	{
 		m_kill = kill;
 	}
+
+	virtual void saveState(EntityState& state)
+	{
+		state.type = getType();
+		state.animation = m_animComp.getAnimation()->id;
+		state.currentFrame = m_animComp.getCurrentFrame();
+		state.kill = m_kill;
+		state.collisionIsKill = m_collision.getIsKill();
+		state.location = m_location;
+		state.collisionSize = m_collision.getSize();
+		state.collisionRelativeLocation = m_collision.getRelativeLocation();
+	}
+
+	virtual void loadState(const EntityState& state, Animation* anim)
+	{
+		m_kill = state.kill;
+		m_location = state.location;
+		m_collision.setupCollision(state.collisionSize, state.collisionRelativeLocation, m_location);
+		m_collision.setIsKill(state.collisionIsKill);
+		m_animComp.setState(anim, state.currentFrame);
+		m_animComp.getSprite().setPosition(m_location);
+	}
+
+	void saveView(spectator::EntityView& view)
+	{
+		view.id = m_entityId;
+		view.x = m_location.x;
+		view.y = m_location.y;
+		view.color = m_animComp.getSprite().getColor().toInteger();
+		view.animation = m_animComp.getAnimation()->id;
+		view.frame = m_animComp.getCurrentFrame();
+	}
 };
 
 class Ground : public GameObject
@@ -298,19 +733,28 @@ public:
 	Ground(sf::Vector2f location, Animation *startAnim, sf::Vector2f collisionSize, sf::Vector2f collisionRelativeLoc)
 		: GameObject(location, collisionSize, collisionRelativeLoc, startAnim)
 	{}
+
+	virtual ObjectType getType()
+	{
+		return ObjectType::Ground;
+	}
 };
 
 class Character : public GameObject
 {
 protected:
-	const float m_gravityModifier{0.033};
-	const float m_airResistance{0.5};
-	const float m_groundResistance{0.1};
-	const float m_movementSpeed{ 1 };
+	const float m_gravityModifier{ characterGravityModifier };
+	const float m_airResistance{ characterAirResistance };
+	const float m_groundResistance{ characterGroundResistance };
+	const float m_movementSpeed{ characterMovementSpeed };
 	sf::Vector2f m_lastPosition{};
 	sf::Vector2f m_force{0, 0};
 	bool onGround{ false };
+	bool m_jumpFired{ false };
+	bool m_jumped{ false };
+	unsigned int m_playerSlot{ 0 };
 	sf::Sound* m_jumpSound;
+	std::vector<sf::Vector2f> m_contactNormals;
 
 public:
 	Character(sf::Vector2f location, Animation* startAnim, sf::Vector2f collisionSize, sf::Vector2f collisionRelativeLoc, sf::Sound* jumpSound)
@@ -321,6 +765,73 @@ public:
 	bool movingLeft{ false };
 	bool jumping{ false };
 
+	virtual ObjectType getType()
+	{
+		return ObjectType::Character;
+	}
+
+	//Player one keeps the untinted sprite
+	void setPlayerSlot(unsigned int slot)
+	{
+		const sf::Color playerTints[maxPlayers]{
+			sf::Color::White, sf::Color(255, 150, 150), sf::Color(150, 200, 255), sf::Color(170, 255, 150),
+			sf::Color(255, 230, 120), sf::Color(230, 150, 255), sf::Color(120, 255, 230), sf::Color(255, 190, 120) };
+
+		m_playerSlot = slot;
+		m_animComp.getSprite().setColor(playerTints[slot % maxPlayers]);
+	}
+
+	unsigned int getPlayerSlot()
+	{
+		return m_playerSlot;
+	}
+
+	std::uint8_t getInput()
+	{
+		return (movingRight ? InputRight : 0) | (movingLeft ? InputLeft : 0) | (jumping ? InputJump : 0);
+	}
+
+	void setInput(std::uint8_t input)
+	{
+		movingRight = (input & InputRight) != 0;
+		movingLeft = (input & InputLeft) != 0;
+		jumping = (input & InputJump) != 0;
+	}
+
+	//True once after the tick where a jump first moved the character, the tick after it fired
+	bool consumeJumped()
+	{
+		bool jumped{ m_jumped };
+		m_jumped = false;
+		return jumped;
+	}
+
+	virtual void saveState(EntityState& state)
+	{
+		GameObject::saveState(state);
+		state.playerSlot = m_playerSlot;
+		state.lastPosition = m_lastPosition;
+		state.force = m_force;
+		state.onGround = onGround;
+		state.movingRight = movingRight;
+		state.movingLeft = movingLeft;
+		state.jumping = jumping;
+	}
+
+	virtual void loadState(const EntityState& state, Animation* anim)
+	{
+		GameObject::loadState(state, anim);
+		setPlayerSlot(state.playerSlot);
+		m_lastPosition = state.lastPosition;
+		m_force = state.force;
+		onGround = state.onGround;
+		movingRight = state.movingRight;
+		movingLeft = state.movingLeft;
+		jumping = state.jumping;
+		m_jumpFired = false;
+		m_jumped = false;
+	}
+
 	void addForce(sf::Vector2f force)
 	{
 		m_force.x += force.x;
@@ -349,6 +860,10 @@ public:
 		m_lastPosition = m_location;
 
 		m_location += m_force;
+
+		//The jump force is added after this tick has moved, so it only shows from the next one
+		m_jumped = m_jumped || m_jumpFired;
+		m_jumpFired = false;
 		
 		if (onGround)
 		{
@@ -356,8 +871,9 @@ public:
 
 			if (jumping)
 			{
-				addForce(sf::Vector2f(0, -3));
+				addForce(sf::Vector2f(0, -characterJumpForce));
 				m_jumpSound->play();
+				m_jumpFired = true;
 			}
 		}
 		else
@@ -374,6 +890,7 @@ public:
 		GameObject::checkCollision(collidedObjects);
 
 		onGround = false;
+		m_contactNormals.clear();
 
 		if (!collidedObjects.empty())
 		{
@@ -383,6 +900,12 @@ public:
 				{
 					m_kill = true;
 				}
+
+				//Resting on the ground or against the ceiling is not an event, the kill volume is
+				if (collidedObjects[i]->getType() != ObjectType::Ground || collidedObjects[i]->getCollision()->getIsKill())
+				{
+					telemetry::record(telemetry::EventType::Collision, (float)m_playerSlot, m_location.x, m_location.y, collidedObjects[i]->getCollision()->getIsKill() ? 1.f : 0.f);
+				}
 				
 				{
 					float distanceX{ m_lastPosition.x - collidedObjects[i]->getCollision()->getLines()->position.x };
@@ -412,11 +935,13 @@ public:
 						if (distanceX < 0)
 						{
 							newX = collidedObjects[i]->getCollision()->getLines()->position.x - m_collision.getSize().x - 1;
+							m_contactNormals.push_back(sf::Vector2f(-1, 0));
 							//LOG("Push Left");
 						}
 						else
 						{
 							newX = collidedObjects[i]->getCollision()->getLines()->position.x + collidedObjects[i]->getCollision()->getSize().x + 1;
+							m_contactNormals.push_back(sf::Vector2f(1, 0));
 							//LOG("Push Right");
 						}
 
@@ -431,6 +956,7 @@ public:
 						{
 							newY = collidedObjects[i]->getCollision()->getLines()->position.y - m_collision.getSize().y;
 							onGround = true;
+							m_contactNormals.push_back(sf::Vector2f(0, -1));
 							//LOG("Push Up");
 
 							if (m_force.y > 0)
@@ -442,6 +968,7 @@ public:
 						{
 							sf::Vertex* vertextPtr{ collidedObjects[i]->getCollision()->getLines() + 3 };
 							newY = vertextPtr->position.y + 1;
+							m_contactNormals.push_back(sf::Vector2f(0, 1));
 
 							//newY = collidedObjects[i]->getCollision()->getLines()->position.y + m_collision.getSize().y + 1;
 							//LOG("Push Down");
@@ -460,6 +987,21 @@ public:
 		}
 	}
 
+	virtual void drawDebug(DebugDraw& debugDraw)
+	{
+		GameObject::drawDebug(debugDraw);
+
+		sf::FloatRect bounds{ m_collision.getBounds() };
+		sf::Vector2f center{ bounds.left + bounds.width / 2, bounds.top + bounds.height / 2 };
+
+		debugDraw.addVector(center, m_force * 4.f, sf::Color::Green);
+
+		for (unsigned int i{}; i < m_contactNormals.size(); ++i)
+		{
+			debugDraw.addVector(center, m_contactNormals[i] * 12.f, sf::Color::Yellow);
+		}
+	}
+
 };
 
 class Obstacle : public GameObject
@@ -469,10 +1011,7 @@ private:
 
 public:
 	Obstacle(sf::Vector2f startLoc, Animation *startAnim, sf::Vector2f colSize, sf::Vector2f colLocation, float speed) :
-		GameObject(startLoc, colSize, colLocation, startAnim), m_speed{ speed }
-	{
-		LOG(m_speed);
-	}
+		GameObject(startLoc, colSize, colLocation, startAnim), m_speed{ speed }{}
 
 	virtual void logicTick()
 	{
@@ -485,160 +1024,1888 @@ public:
 	{
 		m_speed = newSpeed;
 	}
-};
 
-class ObstacleSpawner : public GameObject
-{
-private:
-	int m_lastSpawn{};
-	std::vector<GameObject*>* m_staticObjectRef;
-	sf::Vector2f m_spawnLoc;
+	virtual ObjectType getType()
+	{
+		return ObjectType::Obstacle;
+	}
+
+	virtual void saveState(EntityState& state)
+	{
+		GameObject::saveState(state);
+		state.speed = m_speed;
+	}
+
+	virtual void loadState(const EntityState& state, Animation* anim)
+	{
+		GameObject::loadState(state, anim);
+		m_speed = state.speed;
+	}
+};
+
+class ObstacleSpawner : public GameObject
+{
+private:
+	int m_lastSpawn{};
+	std::vector<GameObject*>* m_staticObjectRef;
+	Random* m_random;
+	sf::Vector2f m_spawnLoc;
 	Animation* m_startAnim;
 	Animation* m_bigAnim;
 	Animation* m_flyingAnim;
-	float m_pixelSpeed{ 1 };
-	const float m_boxMinDistance{60.0};
+	DifficultyParameters m_difficulty;
+	float m_pixelSpeed;
 
 public:
 	ObstacleSpawner() = default;
-	ObstacleSpawner(std::vector<GameObject*>* staticArray, sf::Vector2f startLoc, Animation* startAnim, Animation* rockAnim, Animation* treeAnim, Animation* emptyAnim, sf::Vector2f colSize, sf::Vector2f colLocation, sf::Vector2f spawnLoc) :
-		GameObject(startLoc, colSize, colLocation, emptyAnim), m_staticObjectRef{ staticArray }, m_spawnLoc{ spawnLoc }, m_startAnim{ startAnim }, m_bigAnim{ rockAnim }, m_flyingAnim{ treeAnim }{}
+	ObstacleSpawner(std::vector<GameObject*>* staticArray, Random* random, DifficultyParameters difficulty, sf::Vector2f startLoc, Animation* startAnim, Animation* rockAnim, Animation* treeAnim, Animation* emptyAnim, sf::Vector2f colSize, sf::Vector2f colLocation, sf::Vector2f spawnLoc) :
+		GameObject(startLoc, colSize, colLocation, emptyAnim), m_staticObjectRef{ staticArray }, m_random{ random }, m_spawnLoc{ spawnLoc }, m_startAnim{ startAnim }, m_bigAnim{ rockAnim }, m_flyingAnim{ treeAnim },
+		m_difficulty{ difficulty }, m_pixelSpeed{ difficulty.startSpeed }{}
 
 	virtual void logicTick()
 	{
-		m_pixelSpeed += 0.001;
+		m_pixelSpeed += m_difficulty.speedIncrease;
+
+		int percChance{ (int)(m_random->next() % 100) };
+
+		if ((percChance >= 100 - m_difficulty.spawnChance) && (++m_lastSpawn > m_difficulty.minSpawnDistance / m_pixelSpeed))
+		{
+			int isLargeBox{ (int)(m_random->next() % 100) };
+
+			if (isLargeBox < m_difficulty.rockChance)
+			{
+				//sf::Vector2f(30, 30)
+				//sf::Vector2f(0, 0)
+				m_staticObjectRef->push_back(new Obstacle(m_spawnLoc, m_bigAnim, sf::Vector2f(30, 30), sf::Vector2f(0, 0), m_pixelSpeed));
+			}
+			else if (isLargeBox < m_difficulty.rockChance + m_difficulty.stumpChance)
+			{
+				m_staticObjectRef->push_back(new Obstacle(sf::Vector2f(m_spawnLoc.x, m_spawnLoc.y + 10), m_startAnim, sf::Vector2f(20, 20), sf::Vector2f(0, 0), m_pixelSpeed));
+			}
+			else
+			{
+				m_staticObjectRef->push_back(new Obstacle(sf::Vector2f(m_spawnLoc.x, m_spawnLoc.y - 20), m_flyingAnim, sf::Vector2f(20, 20), sf::Vector2f(0, 0), m_pixelSpeed));
+			}
+			m_lastSpawn = 0;
+
+			GameObject* spawned{ m_staticObjectRef->back() };
+			telemetry::record(telemetry::EventType::Spawn, spawned->getLocation().x, spawned->getLocation().y, spawned->getCollision()->getBounds().width, m_pixelSpeed);
+		}
+
+		GameObject::logicTick();
+	}
+
+	virtual ObjectType getType()
+	{
+		return ObjectType::ObstacleSpawner;
+	}
+
+	virtual void saveState(EntityState& state)
+	{
+		GameObject::saveState(state);
+		state.speed = m_pixelSpeed;
+		state.lastSpawn = m_lastSpawn;
+		state.spawnLocation = m_spawnLoc;
+	}
+
+	virtual void loadState(const EntityState& state, Animation* anim)
+	{
+		GameObject::loadState(state, anim);
+		m_pixelSpeed = state.speed;
+		m_lastSpawn = state.lastSpawn;
+		m_spawnLoc = state.spawnLocation;
+	}
+};
+
+class CollisionHandler
+{
+private:
+	bool checkAxis(GameObject* currentObject, GameObject* checkObject, int vertexToCheck, bool checkX)
+	{
+		sf::Vertex* currentMax{currentObject->getCollision()->getLines() + vertexToCheck};
+		sf::Vertex* currentMin = currentMax + 1;
+
+		sf::Vertex* checkMax{checkObject->getCollision()->getLines() + vertexToCheck};
+		sf::Vertex* checkMin = checkMax + 1;
+
+		bool MaxWithinBounds{};
+		bool MinWithinBounds{};
+
+		if (checkX)
+		{
+			MaxWithinBounds = (currentMax->position.x >= checkMax->position.x) && (currentMax->position.x <= checkMin->position.x);
+			MinWithinBounds = (currentMin->position.x >= checkMax->position.x) && (currentMin->position.x <= checkMin->position.x);
+		}
+		else
+		{
+			MaxWithinBounds = (currentMax->position.y >= checkMax->position.y) && (currentMax->position.y <= checkMin->position.y);
+			MinWithinBounds = (currentMin->position.y >= checkMax->position.y) && (currentMin->position.y <= checkMin->position.y);
+		}
+
+		return (MaxWithinBounds || MinWithinBounds);
+	}
+
+public:
+	CollisionHandler(GameObject* objectToTest, std::vector<GameObject*> objectsToTestAgainst)
+	{
+		std::vector<GameObject*> tempVector;
+
+		for (unsigned int j{}; j < objectsToTestAgainst.size(); ++j)
+		{
+				bool xCollides{ checkAxis(objectToTest, objectsToTestAgainst[j], 0, true) };
+				bool yCollides{ checkAxis(objectToTest, objectsToTestAgainst[j], 2, false) };
+
+				if (xCollides && yCollides)
+				{
+					tempVector.push_back(objectsToTestAgainst[j]);
+				}
+		}
+		objectToTest->checkCollision(tempVector);
+	}
+};
+
+//Uniform grid over the area objects are allowed to live in. Its bounds are the kill
+//bounds, the collision broadphase reads its cells and the visible set is built in the same pass.
+class SpatialGrid
+{
+private:
+	sf::FloatRect m_bounds;
+	sf::FloatRect m_view;
+	float m_cellSize;
+	int m_columns;
+	int m_rows;
+	std::vector<std::vector<unsigned int>> m_cells;
+	std::vector<unsigned int> m_candidates;
+	std::vector<GameObject*> m_visible;
+
+	void cellRange(const sf::FloatRect& rect, int& minX, int& minY, int& maxX, int& maxY)
+	{
+		minX = std::max(0, (int)std::floor((rect.left - m_bounds.left) / m_cellSize));
+		minY = std::max(0, (int)std::floor((rect.top - m_bounds.top) / m_cellSize));
+		maxX = std::min(m_columns - 1, (int)std::floor((rect.left + rect.width - m_bounds.left) / m_cellSize));
+		maxY = std::min(m_rows - 1, (int)std::floor((rect.top + rect.height - m_bounds.top) / m_cellSize));
+	}
+
+	void insert(unsigned int index, const sf::FloatRect& rect)
+	{
+		int minX, minY, maxX, maxY;
+		cellRange(rect, minX, minY, maxX, maxY);
+
+		for (int y{ minY }; y <= maxY; ++y)
+		{
+			for (int x{ minX }; x <= maxX; ++x)
+			{
+				m_cells[y * m_columns + x].push_back(index);
+			}
+		}
+	}
+
+	void addObject(GameObject* object, unsigned int index)
+	{
+		//Only dead players are still listed while flagged
+		if (object->getKill())
+		{
+			return;
+		}
+
+		sf::FloatRect collisionBounds{ object->getCollision()->getBounds() };
+		insert(index, collisionBounds);
+
+		if (object->isDrawable())
+		{
+			sf::FloatRect spriteBounds{ object->getSpriteBounds() };
+
+			if (spriteBounds.intersects(m_view))
+			{
+				m_visible.push_back(object);
+			}
+		}
+	}
+
+public:
+	//The view is padded by a cell so sprites are synced before they scroll in
+	SpatialGrid(sf::FloatRect bounds, sf::FloatRect view, float cellSize) :
+		m_bounds{ bounds }, m_view{ view.left - cellSize, view.top - cellSize, view.width + cellSize * 2, view.height + cellSize * 2 }, m_cellSize{ cellSize },
+		m_columns{ (int)std::ceil(bounds.width / cellSize) }, m_rows{ (int)std::ceil(bounds.height / cellSize) }, m_cells(m_columns * m_rows)
+	{}
+
+	bool isInside(sf::Vector2f location)
+	{
+		return (location.x >= m_bounds.left && location.x <= m_bounds.left + m_bounds.width) && (location.y >= m_bounds.top && location.y <= m_bounds.top + m_bounds.height);
+	}
+
+	void rebuild(std::vector<GameObject*>& staticObjects, std::vector<GameObject*>& dynamicObjects)
+	{
+		for (unsigned int i{}; i < m_cells.size(); ++i)
+		{
+			m_cells[i].clear();
+		}
+		m_visible.clear();
+
+		for (unsigned int i{}; i < staticObjects.size(); ++i)
+		{
+			addObject(staticObjects[i], i);
+		}
+
+		for (unsigned int i{}; i < dynamicObjects.size(); ++i)
+		{
+			addObject(dynamicObjects[i], staticObjects.size() + i);
+		}
+	}
+
+	//Static objects sharing a cell with rect, kept in list order so collision response is unchanged
+	void queryStatic(const sf::FloatRect& rect, std::vector<GameObject*>& staticObjects, std::vector<GameObject*>& result)
+	{
+		int minX, minY, maxX, maxY;
+		cellRange(rect, minX, minY, maxX, maxY);
+
+		m_candidates.clear();
+		for (int y{ minY }; y <= maxY; ++y)
+		{
+			for (int x{ minX }; x <= maxX; ++x)
+			{
+				std::vector<unsigned int>& cell{ m_cells[y * m_columns + x] };
+
+				for (unsigned int i{}; i < cell.size(); ++i)
+				{
+					if (cell[i] < staticObjects.size())
+					{
+						m_candidates.push_back(cell[i]);
+					}
+				}
+			}
+		}
+
+		std::sort(m_candidates.begin(), m_candidates.end());
+		m_candidates.erase(std::unique(m_candidates.begin(), m_candidates.end()), m_candidates.end());
+
+		result.clear();
+		for (unsigned int i{}; i < m_candidates.size(); ++i)
+		{
+			result.push_back(staticObjects[m_candidates[i]]);
+		}
+	}
+
+	std::vector<GameObject*>& getVisible()
+	{
+		return m_visible;
+	}
+
+	void drawDebug(DebugDraw& debugDraw)
+	{
+		sf::Color cellColor{ 0, 128, 255, 96 };
+
+		for (int y{}; y < m_rows; ++y)
+		{
+			for (int x{}; x < m_columns; ++x)
+			{
+				if (!m_cells[y * m_columns + x].empty())
+				{
+					debugDraw.addBox(sf::FloatRect(m_bounds.left + x * m_cellSize, m_bounds.top + y * m_cellSize, m_cellSize, m_cellSize), cellColor);
+				}
+			}
+		}
+
+		debugDraw.addBox(m_view, sf::Color::Cyan);
+	}
+};
+
+struct SimulationResources
+{
+	Animation* animations[AnimationCount];
+	sf::Sound* jumpSound;
+	DifficultyParameters difficulty;
+};
+
+class World
+{
+private:
+	SimulationResources m_resources;
+	sf::Vector2i m_resolution;
+	Random m_random;
+	Background m_background;
+	std::vector<GameObject*> m_staticObjects;
+	std::vector<GameObject*> m_dynamicObjects;
+	std::vector<Character*> m_players;
+	unsigned int m_frameCount{ 0 };
+	std::uint32_t m_tickCount{ 0 };
+	SpatialGrid m_grid;
+	std::vector<GameObject*> m_collisionCandidates;
+	DebugDraw m_debugDraw;
+	SpriteBatch m_spriteBatch;
+
+	void collectPlayers()
+	{
+		m_players.clear();
+
+		for (unsigned int i{}; i < m_dynamicObjects.size(); ++i)
+		{
+			if (m_dynamicObjects[i]->getType() == ObjectType::Character)
+			{
+				m_players.push_back(static_cast<Character*>(m_dynamicObjects[i]));
+			}
+		}
+
+		std::sort(m_players.begin(), m_players.end(), [](Character* a, Character* b) { return a->getPlayerSlot() < b->getPlayerSlot(); });
+	}
+
+	//LevelBox holds the collision box, the object sits collisionOffset to its left
+	static sf::Vector2f boxLocation(const LevelBox& box)
+	{
+		return sf::Vector2f(box.left - box.collisionOffset, box.top);
+	}
+
+	static sf::Vector2f boxSize(const LevelBox& box)
+	{
+		return sf::Vector2f(box.width, box.height);
+	}
+
+	static sf::Vector2f boxOffset(const LevelBox& box)
+	{
+		return sf::Vector2f(box.collisionOffset, 0);
+	}
+
+	GameObject* createObject(const EntityState& state)
+	{
+		Animation** anims{ m_resources.animations };
+		GameObject* object{};
+
+		switch (state.type)
+		{
+		case ObjectType::Ground:
+			object = new Ground(state.location, anims[state.animation], state.collisionSize, state.collisionRelativeLocation);
+			break;
+
+		case ObjectType::Character:
+			object = new Character(state.location, anims[state.animation], state.collisionSize, state.collisionRelativeLocation, m_resources.jumpSound);
+			break;
+
+		case ObjectType::Obstacle:
+			object = new Obstacle(state.location, anims[state.animation], state.collisionSize, state.collisionRelativeLocation, state.speed);
+			break;
+
+		case ObjectType::ObstacleSpawner:
+			object = new ObstacleSpawner(&m_staticObjects, &m_random, m_resources.difficulty, state.location, anims[StumpAnim], anims[RockAnim], anims[TreeAnim], anims[EmptyAnim], state.collisionSize, state.collisionRelativeLocation, state.spawnLocation);
+			break;
+		}
+
+		object->loadState(state, anims[state.animation]);
+		return object;
+	}
+
+	//Reuses objects of matching type in place, only allocating when the layout differs
+	void restoreObjects(std::vector<GameObject*>& objects, const EntityState* states, unsigned int count)
+	{
+		for (unsigned int i{}; i < count; ++i)
+		{
+			if (i >= objects.size())
+			{
+				objects.push_back(createObject(states[i]));
+			}
+			else if (objects[i]->getType() == states[i].type)
+			{
+				objects[i]->loadState(states[i], m_resources.animations[states[i].animation]);
+			}
+			else
+			{
+				delete objects[i];
+				objects[i] = createObject(states[i]);
+			}
+		}
+
+		for (unsigned int i{ (unsigned int)objects.size() }; i-- > count;)
+		{
+			delete objects[i];
+			objects.pop_back();
+		}
+	}
+
+public:
+	World(SimulationResources resources, sf::Texture& backgroundTexture, sf::Texture& groundTexture, sf::Vector2i resolution, std::uint32_t seed, unsigned int playerCount = 1)
+		: m_resources{ resources }, m_resolution{ resolution }, m_random{ seed ? seed : 1 }, m_background{ backgroundTexture, sf::Vector2f(resolution.x, resolution.y), backgroundFarScroll },
+		m_grid{ sf::FloatRect(-levelBoundsMargin, -levelBoundsMargin, levelWidth + levelBoundsMargin * 2, levelHeight + levelBoundsMargin * 2), sf::FloatRect(0, 0, resolution.x, resolution.y), 40 }
+	{
+		m_background.addLayer(groundTexture, 1);
+
+		Animation** anims{ m_resources.animations };
+
+		m_staticObjects.push_back(new Ground(boxLocation(levelGround), anims[EmptyAnim], boxSize(levelGround), boxOffset(levelGround)));
+		m_staticObjects.push_back(new Ground(boxLocation(levelCeiling), anims[EmptyAnim], boxSize(levelCeiling), boxOffset(levelCeiling)));
+		m_staticObjects.push_back(new ObstacleSpawner(&m_staticObjects, &m_random, m_resources.difficulty, boxLocation(levelSpawnerColumn), anims[StumpAnim], anims[RockAnim], anims[TreeAnim], anims[EmptyAnim], boxSize(levelSpawnerColumn), boxOffset(levelSpawnerColumn), sf::Vector2f(obstacleSpawnX, obstacleSpawnY)));
 
-		int percChance{ rand() % 100 };
+		GameObject* isKillVolume{ new Ground(boxLocation(levelKillVolume), anims[MachineAnim], boxSize(levelKillVolume), boxOffset(levelKillVolume)) };
+		isKillVolume->setCollisionIsKill(levelKillVolume.isKill);
+		m_staticObjects.push_back(isKillVolume);
 
-		if ((percChance > 70) && (++m_lastSpawn > m_boxMinDistance / m_pixelSpeed))
+		//Players line up around the single player start
+		for (unsigned int i{}; i < playerCount; ++i)
 		{
-			int isLargeBox{ rand() % 100};
+			Character* player{ new Character(sf::Vector2f(playerStartX + playerSpacing * i - playerSpacing / 2 * (playerCount - 1), playerStartY), anims[PlayerRunAnim], sf::Vector2f(playerSize, playerSize), sf::Vector2f(0, 0), m_resources.jumpSound) };
+			player->setPlayerSlot(i);
+
+			m_players.push_back(player);
+			m_dynamicObjects.push_back(player);
+		}
+
+		m_grid.rebuild(m_staticObjects, m_dynamicObjects);
+	}
+
+	~World()
+	{
+		for (unsigned int i{}; i < m_staticObjects.size(); ++i)
+		{
+			delete m_staticObjects[i];
+		}
+
+		for (unsigned int i{}; i < m_dynamicObjects.size(); ++i)
+		{
+			delete m_dynamicObjects[i];
+		}
+	}
+
+	void logicTick()
+	{
+		telemetry::setTick(++m_tickCount);
+
+		bool wasAlive[maxPlayers]{};
+		for (unsigned int i{}; i < m_players.size() && i < maxPlayers; ++i)
+		{
+			wasAlive[i] = !m_players[i]->getKill();
+		}
+
+		m_background.tick();
+
+		//Check Collision, dead players sit out until restart
+		for (unsigned int i{}; i < m_dynamicObjects.size(); ++i)
+		{
+			if (m_dynamicObjects[i]->getKill())
+			{
+				continue;
+			}
+
+			m_grid.queryStatic(m_dynamicObjects[i]->getCollision()->getBounds(), m_staticObjects, m_collisionCandidates);
+			CollisionHandler handler(m_dynamicObjects[i], m_collisionCandidates);
+		}
+
+		//Update static objects
+		for (unsigned int i{}; i < m_staticObjects.size(); ++i)
+		{
+			m_staticObjects[i]->logicTick();
+		}
+
+		//Update dynamic objects
+		for (unsigned int i{}; i < m_dynamicObjects.size(); ++i)
+		{
+			if (!m_dynamicObjects[i]->getKill())
+			{
+				m_dynamicObjects[i]->logicTick();
+			}
+		}
+
+		//Check distances
+
+		for (unsigned int i{}; i < m_staticObjects.size(); ++i)
+		{
+			if (!m_grid.isInside(m_staticObjects[i]->getLocation()))
+			{
+				m_staticObjects[i]->setKill(true);
+			}
+		}
+
+		for (unsigned int i{}; i < m_dynamicObjects.size(); ++i)
+		{
+			if (!m_grid.isInside(m_dynamicObjects[i]->getLocation()))
+			{
+				m_dynamicObjects[i]->setKill(true);
+			}
+		}
+
+		for (unsigned int i{}; i < m_players.size() && i < maxPlayers; ++i)
+		{
+			if (wasAlive[i] && m_players[i]->getKill())
+			{
+				telemetry::record(telemetry::EventType::Death, (float)m_players[i]->getPlayerSlot(), m_players[i]->getLocation().x, m_players[i]->getLocation().y, (float)countAlivePlayers());
+			}
+		}
+
+		//Delete flagged objects, players are kept so the game can read their state
+		for (unsigned int i{ (unsigned int)m_staticObjects.size() }; i-- > 0;)
+		{
+			if (m_staticObjects[i]->getKill())
+			{
+				delete m_staticObjects[i];
+				m_staticObjects.erase(m_staticObjects.begin() + i);
+			}
+		}
+
+		for (unsigned int i{ (unsigned int)m_dynamicObjects.size() }; i-- > 0;)
+		{
+			if (m_dynamicObjects[i]->getKill() && m_dynamicObjects[i]->getType() != ObjectType::Character)
+			{
+				delete m_dynamicObjects[i];
+				m_dynamicObjects.erase(m_dynamicObjects.begin() + i);
+			}
+		}
+
+		//Bin survivors and collect what is on screen
+		m_grid.rebuild(m_staticObjects, m_dynamicObjects);
+
+		std::vector<GameObject*>& visible{ m_grid.getVisible() };
+
+		for (unsigned int i{}; i < visible.size(); ++i)
+		{
+			visible[i]->syncSprite();
+		}
+
+		//LOG(frameCount);
+
+		if (++m_frameCount >= 2)
+		{
+			m_frameCount = 0;
+
+			LOG("--Update frame--");
+
+			//Graphic update visible objects, static before dynamic
+
+			for (unsigned int i{}; i < visible.size(); ++i)
+			{
+				visible[i]->graphicTick();
+			}
+		}
+	}
+
+	void draw(sf::RenderTexture& texture)
+	{
+		m_background.draw(texture);
+
+		//Draw visible objects, static before dynamic
+		std::vector<GameObject*>& visible{ m_grid.getVisible() };
+
+		for (unsigned int i{}; i < visible.size(); ++i)
+		{
+			visible[i]->drawObject(m_spriteBatch, texture);
+		}
+		m_spriteBatch.flush(texture);
+
+		if (m_debugDraw.isEnabled())
+		{
+			m_grid.drawDebug(m_debugDraw);
+
+			for (unsigned int i{}; i < m_staticObjects.size(); ++i)
+			{
+				m_staticObjects[i]->drawDebug(m_debugDraw);
+			}
+
+			for (unsigned int i{}; i < m_dynamicObjects.size(); ++i)
+			{
+				m_dynamicObjects[i]->drawDebug(m_debugDraw);
+			}
+
+			m_debugDraw.draw(texture);
+		}
+	}
+
+	void toggleDebugDraw()
+	{
+		m_debugDraw.toggle();
+	}
+
+	Background& getBackground()
+	{
+		return m_background;
+	}
+
+	std::vector<Character*>& getPlayers()
+	{
+		return m_players;
+	}
+
+	unsigned int countAlivePlayers()
+	{
+		unsigned int alive{};
+
+		for (unsigned int i{}; i < m_players.size(); ++i)
+		{
+			if (!m_players[i]->getKill())
+			{
+				++alive;
+			}
+		}
+
+		return alive;
+	}
+
+	unsigned int countVisible()
+	{
+		return (unsigned int)m_grid.getVisible().size();
+	}
+
+	//What a spectator sees this tick, everything on screen sorted by entity id
+	void captureView(spectator::FrameView& view)
+	{
+		view.tick = m_tickCount;
+
+		view.backgroundOffsets.resize(m_background.getLayerCount());
+		for (unsigned int i{}; i < view.backgroundOffsets.size(); ++i)
+		{
+			view.backgroundOffsets[i] = m_background.getOffset(i);
+		}
+
+		std::vector<GameObject*>& visible{ m_grid.getVisible() };
+
+		view.entities.resize(visible.size());
+		for (unsigned int i{}; i < visible.size(); ++i)
+		{
+			visible[i]->saveView(view.entities[i]);
+		}
+
+		std::sort(view.entities.begin(), view.entities.end(), [](const spectator::EntityView& a, const spectator::EntityView& b) { return a.id < b.id; });
+	}
+
+	bool capture(SimulationSnapshot& snapshot)
+	{
+		if (m_staticObjects.size() + m_dynamicObjects.size() > maxSnapshotEntities)
+		{
+			return false;
+		}
+
+		snapshot.staticCount = m_staticObjects.size();
+		snapshot.dynamicCount = m_dynamicObjects.size();
+
+		for (unsigned int i{}; i < m_staticObjects.size(); ++i)
+		{
+			m_staticObjects[i]->saveState(snapshot.entities[i]);
+		}
+
+		for (unsigned int i{}; i < m_dynamicObjects.size(); ++i)
+		{
+			m_dynamicObjects[i]->saveState(snapshot.entities[snapshot.staticCount + i]);
+		}
+
+		snapshot.backgroundSpeed = m_background.getSpeed();
+
+		for (unsigned int i{}; i < maxBackgroundLayers; ++i)
+		{
+			snapshot.backgroundOffsets[i] = m_background.getOffset(i);
+		}
+		snapshot.randomState = m_random.state;
+		snapshot.frameCount = m_frameCount;
+
+		return true;
+	}
+
+	void restore(const SimulationSnapshot& snapshot)
+	{
+		restoreObjects(m_staticObjects, snapshot.entities, snapshot.staticCount);
+		restoreObjects(m_dynamicObjects, snapshot.entities + snapshot.staticCount, snapshot.dynamicCount);
+
+		collectPlayers();
+
+		m_background.setState(snapshot.backgroundSpeed, snapshot.backgroundOffsets);
+		m_random.state = snapshot.randomState;
+		m_frameCount = snapshot.frameCount;
+
+		m_grid.rebuild(m_staticObjects, m_dynamicObjects);
+
+		telemetry::record(telemetry::EventType::Restart, (float)(snapshot.staticCount + snapshot.dynamicCount));
+	}
+};
+
+//Textures and the animations that reference them, shared by the game and headless export
+struct GameAssets
+{
+	sf::Texture background;
+	sf::Texture backgroundGround;
+	sf::Texture playerTexture;
+	sf::Texture rockTexture;
+	sf::Texture stumpTexture;
+	sf::Texture treeTexture;
+	sf::Texture machineTexture;
+	sf::Texture emptyTexture;
+
+	Animation playerRun{ playerTexture, 6, true, PlayerRunAnim };
+	Animation rock{ rockTexture, 1, true, RockAnim };
+	Animation stump{ stumpTexture, 1, true, StumpAnim };
+	Animation tree{ treeTexture, 1, true, TreeAnim };
+	Animation machine{ machineTexture, 2, true, MachineAnim };
+	Animation emptyAnim{ emptyTexture, 0 , false, EmptyAnim };
+
+	void load()
+	{
+		sf::Image backgroundImage;
+		backgroundImage.loadFromFile("Textures/Background.png");
+		sf::Vector2u backgroundSize{ backgroundImage.getSize() };
+
+		//Same size as the full art so both layers wrap together, transparent above the ground
+		sf::Image groundImage;
+		groundImage.create(backgroundSize.x, backgroundSize.y, sf::Color::Transparent);
+
+		if (backgroundSize.y > backgroundGroundRow)
+		{
+			//The row above the cut is all hill, below it any pixel in one of its colours is still hill
+			std::vector<sf::Color> hillColors;
+
+			for (unsigned int x{}; x < backgroundSize.x; ++x)
+			{
+				sf::Color color{ backgroundImage.getPixel(x, backgroundGroundRow - 1) };
+
+				if (std::find(hillColors.begin(), hillColors.end(), color) == hillColors.end())
+				{
+					hillColors.push_back(color);
+				}
+			}
+
+			for (unsigned int y{ backgroundGroundRow }; y < backgroundSize.y; ++y)
+			{
+				for (unsigned int x{}; x < backgroundSize.x; ++x)
+				{
+					sf::Color color{ backgroundImage.getPixel(x, y) };
+
+					if (std::find(hillColors.begin(), hillColors.end(), color) == hillColors.end())
+					{
+						groundImage.setPixel(x, y, color);
+
+						//The hills carry on down behind the ground so its gaps show hill, not stray grass
+						backgroundImage.setPixel(x, y, backgroundImage.getPixel(x, y - 1));
+					}
+				}
+			}
+		}
+
+		background.loadFromImage(backgroundImage);
+		backgroundGround.loadFromImage(groundImage);
+
+		playerTexture.loadFromFile("Textures/KiwiRun.png");
+		rockTexture.loadFromFile("Textures/Rock.png");
+		stumpTexture.loadFromFile("Textures/Stump.png");
+		treeTexture.loadFromFile("Textures/Tree.png");
+		machineTexture.loadFromFile("Textures/Machine.png");
+	}
+
+	SimulationResources getResources(sf::Sound* jumpSound)
+	{
+		return SimulationResources{ { &playerRun, &rock, &stump, &tree, &machine, &emptyAnim }, jumpSound, DifficultyParameters{} };
+	}
+};
+
+//A run is its starting snapshot plus the input of every tick, the simulation is deterministic from there
+struct Replay
+{
+	SimulationSnapshot start;
+	unsigned int playerCount{ 1 };
+	std::vector<std::uint8_t> inputs;
+
+	static const std::uint32_t magic{ 0x46595752 };
+	static const std::uint32_t version{ 3 };
+
+	unsigned int getTickCount()
+	{
+		return inputs.size() / playerCount;
+	}
+
+	bool save(const std::string& path)
+	{
+		std::ofstream file(path, std::ios::binary);
+		std::uint32_t header[4]{ magic, version, playerCount, (std::uint32_t)inputs.size() };
+
+		file.write((const char*)header, sizeof(header));
+		file.write((const char*)&start, sizeof(start));
+		file.write((const char*)inputs.data(), inputs.size());
+
+		return file.good();
+	}
+
+	bool load(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		std::uint32_t header[4]{};
+
+		file.read((char*)header, sizeof(header));
+		if (!file || header[0] != magic || header[1] != version || header[2] == 0)
+		{
+			return false;
+		}
+
+		//The input count has to match what is actually left in the file
+		std::streamoff inputsStart{ (std::streamoff)(sizeof(header) + sizeof(start)) };
+		file.seekg(0, std::ios::end);
+		std::streamoff fileSize{ file.tellg() };
+
+		if (header[2] > maxPlayers || header[3] % header[2] != 0 || fileSize < inputsStart || (std::uint64_t)(fileSize - inputsStart) != header[3])
+		{
+			return false;
+		}
+
+		file.seekg(sizeof(header));
+		file.read((char*)&start, sizeof(start));
+		if (!file || !start.isValid())
+		{
+			return false;
+		}
+
+		playerCount = header[2];
+		inputs.resize(header[3]);
+		file.read((char*)inputs.data(), inputs.size());
+
+		return (bool)file;
+	}
+};
+
+//Plays a replay into an offscreen render texture as fast as possible and writes every frame out
+int exportReplay(const std::string& replayPath, const std::string& outputPath, capture::Format format)
+{
+	Replay replay;
+	if (!replay.load(replayPath))
+	{
+		std::cout << "Could not read replay " << replayPath << std::endl;
+		return 1;
+	}
+
+	sf::Vector2i targetResolution{ 320, 180 };
+
+	sf::RenderTexture renderTexture;
+	if (!renderTexture.create(targetResolution.x, targetResolution.y))
+	{
+		std::cout << "Could not create render texture" << std::endl;
+		return 1;
+	}
+
+	GameAssets assets;
+	assets.load();
+
+	sf::Sound silentJump;
+	World world(assets.getResources(&silentJump), assets.background, assets.backgroundGround, targetResolution, 1);
+	world.restore(replay.start);
+
+	capture::FrameCapture frameCapture(outputPath, format, targetResolution.x, targetResolution.y);
+	if (frameCapture.getFailed())
+	{
+		std::cout << "Could not write to " << outputPath << std::endl;
+		return 1;
+	}
+
+	auto exportStart{ std::chrono::steady_clock::now() };
+
+	std::vector<Character*>& players{ world.getPlayers() };
+
+	for (unsigned int tick{}; tick < replay.getTickCount(); ++tick)
+	{
+		for (unsigned int i{}; i < players.size() && i < replay.playerCount; ++i)
+		{
+			players[i]->setInput(replay.inputs[tick * replay.playerCount + i]);
+		}
+		world.logicTick();
+
+		renderTexture.clear();
+		world.draw(renderTexture);
+		renderTexture.display();
+
+		frameCapture.capture(renderTexture);
+
+		//A full disk or a folder removed mid export, nothing after this would be written
+		if (frameCapture.getFailed())
+		{
+			std::cout << "Writing frame " << frameCapture.getFramesWritten() << " to " << outputPath << " failed, stopping" << std::endl;
+			break;
+		}
+	}
+
+	frameCapture.finish();
+
+	double seconds{ std::chrono::duration<double>(std::chrono::steady_clock::now() - exportStart).count() };
+	std::cout << "Exported " << frameCapture.getFramesWritten() << " of " << replay.getTickCount() << " frames in " << seconds << "s, "
+		<< (replay.getTickCount() / 36.0) / seconds << "x real time" << std::endl;
+
+	if (format == capture::Format::Raw)
+	{
+		std::cout << "Raw RGBA " << targetResolution.x << "x" << targetResolution.y << " at 36 fps" << std::endl;
+	}
+
+	return frameCapture.getFailed() ? 1 : 0;
+}
+
+//Runs a scripted jumper through a grid of spawner settings and reports how long it survives
+//with each, on every core and without a window
+int tuneDifficulty(unsigned int envCount, unsigned int steps)
+{
+	const int spawnChances[]{ 20, 29, 40 };
+	const float spawnDistances[]{ 45, 60, 75 };
+	unsigned int threadCount{ std::max(1u, std::thread::hardware_concurrency()) };
+
+	std::vector<float> observations(envCount * training::observationSize);
+	std::vector<float> rewards(envCount);
+	std::vector<std::uint8_t> inputs(envCount);
+	std::vector<std::uint8_t> dones(envCount);
+
+	for (unsigned int c{}; c < sizeof(spawnChances) / sizeof(spawnChances[0]); ++c)
+	{
+		for (unsigned int d{}; d < sizeof(spawnDistances) / sizeof(spawnDistances[0]); ++d)
+		{
+			DifficultyParameters difficulty;
+			difficulty.spawnChance = spawnChances[c];
+			difficulty.minSpawnDistance = spawnDistances[d];
+
+			training::BatchEnvironment environment(envCount, threadCount, difficulty, (std::uint32_t)time(nullptr));
+			environment.reset(observations.data());
+
+			auto tuneStart{ std::chrono::steady_clock::now() };
+
+			for (unsigned int step{}; step < steps; ++step)
+			{
+				//Jump once the next obstacle is close
+				for (unsigned int env{}; env < envCount; ++env)
+				{
+					float distance{ observations[env * training::observationSize + 6] };
+					inputs[env] = (distance > 0 && distance < 0.15f) ? InputJump : 0;
+				}
+
+				environment.step(inputs.data(), observations.data(), rewards.data(), dones.data());
+			}
+
+			double seconds{ std::chrono::duration<double>(std::chrono::steady_clock::now() - tuneStart).count() };
+
+			std::cout << "spawn chance " << difficulty.spawnChance << " min distance " << difficulty.minSpawnDistance
+				<< ": mean run " << environment.getMeanEpisodeLength() << " ticks over " << environment.getFinishedEpisodes() << " runs, "
+				<< (double)envCount * steps / seconds / 1000000 << "M ticks/s" << std::endl;
+
+			if (environment.getDroppedObstacles() > 0)
+			{
+				std::cout << "  warning: " << environment.getDroppedObstacles() << " obstacles did not fit, this setting no longer matches the game" << std::endl;
+			}
+		}
+	}
+
+	return 0;
+}
+
+//Prints the first field where the game and the batch disagree
+bool statesMatch(const char* field, double game, double batch, unsigned int run, unsigned int tick)
+{
+	if (game == batch)
+	{
+		return true;
+	}
+
+	std::cout.precision(10);
+	std::cout << "Run " << run << " tick " << tick << ": " << field << " is " << game << " in the game but " << batch << " in the batch" << std::endl;
+	return false;
+}
+
+//BatchEnvironment re-implements Character, Obstacle and ObstacleSpawner by hand. This steps a
+//headless one player World and a one environment batch from the same seed with the same inputs
+//and compares player, spawner and obstacles every tick, any drift makes tuning results meaningless.
+int verifyEnvironment(unsigned int runs, unsigned int maxTicks)
+{
+	GameAssets assets;
+	assets.load();
+
+	sf::Sound silentJump;
+	SimulationResources resources{ assets.getResources(&silentJump) };
+
+	SimulationSnapshot snapshot{};
+	training::EnvironmentState state;
+	std::vector<float> observation(training::observationSize);
+	std::uint64_t totalTicks{};
+
+	for (unsigned int run{}; run < runs; ++run)
+	{
+		std::uint32_t seed{ (run + 1) * 2654435761u };
+		seed = seed ? seed : 1;
+
+		World world(resources, assets.background, assets.backgroundGround, sf::Vector2i(320, 180), seed);
+		Character* player{ world.getPlayers()[0] };
+
+		training::BatchEnvironment environment(1, 1, resources.difficulty, seed);
+		environment.reset(observation.data());
+		environment.setRandomState(0, seed);
+
+		//Jumps at obstacles like the tuner, with random movement and jumps so every branch gets hit
+		Random inputRandom{ seed ^ 0x5BD1E995u };
+		inputRandom.state = inputRandom.state ? inputRandom.state : 1;
+
+		for (unsigned int tick{ 1 }; tick <= maxTicks; ++tick)
+		{
+			unsigned int roll{ inputRandom.next() % 100 };
+			float distance{ observation[6] };
+			std::uint8_t input{ (std::uint8_t)(roll < 20 ? InputRight : roll < 35 ? InputLeft : 0) };
+
+			if ((distance > 0 && distance < 0.15f) || roll % 10 == 0)
+			{
+				input |= InputJump;
+			}
+
+			player->setInput(input);
+			world.logicTick();
+
+			float reward{};
+			std::uint8_t done{};
+			environment.step(&input, observation.data(), &reward, &done);
+			++totalTicks;
+
+			if (done || player->getKill())
+			{
+				if (!statesMatch("player killed", player->getKill(), done != 0, run, tick))
+				{
+					return 1;
+				}
+				break;
+			}
+
+			if (!world.capture(snapshot))
+			{
+				std::cout << "Run " << run << " tick " << tick << ": too many objects to compare, run cut short" << std::endl;
+				break;
+			}
+			environment.getState(0, state);
+
+			const EntityState& character{ snapshot.entities[snapshot.staticCount] };
+			bool same{ statesMatch("player x", character.location.x, state.playerX, run, tick) &&
+				statesMatch("player y", character.location.y, state.playerY, run, tick) &&
+				statesMatch("player last x", character.lastPosition.x, state.lastX, run, tick) &&
+				statesMatch("player last y", character.lastPosition.y, state.lastY, run, tick) &&
+				statesMatch("player force x", character.force.x, state.forceX, run, tick) &&
+				statesMatch("player force y", character.force.y, state.forceY, run, tick) &&
+				statesMatch("player on ground", character.onGround, state.onGround, run, tick) &&
+				statesMatch("random state", snapshot.randomState, state.randomState, run, tick) };
+
+			unsigned int obstacle{};
+
+			for (unsigned int i{}; same && i < snapshot.staticCount; ++i)
+			{
+				const EntityState& entity{ snapshot.entities[i] };
+
+				if (entity.type == ObjectType::ObstacleSpawner)
+				{
+					same = statesMatch("spawner speed", entity.speed, state.pixelSpeed, run, tick) &&
+						statesMatch("spawner last spawn", entity.lastSpawn, state.lastSpawn, run, tick);
+				}
+				else if (entity.type == ObjectType::Obstacle)
+				{
+					if (obstacle >= state.obstacles.size())
+					{
+						same = statesMatch("obstacle count", obstacle + 1, state.obstacles.size(), run, tick);
+						break;
+					}
+
+					const training::ObstacleState& batchObstacle{ state.obstacles[obstacle++] };
+					same = statesMatch("obstacle x", entity.location.x, batchObstacle.x, run, tick) &&
+						statesMatch("obstacle y", entity.location.y, batchObstacle.y, run, tick) &&
+						statesMatch("obstacle width", entity.collisionSize.x, batchObstacle.width, run, tick) &&
+						statesMatch("obstacle height", entity.collisionSize.y, batchObstacle.height, run, tick) &&
+						statesMatch("obstacle speed", entity.speed, batchObstacle.speed, run, tick);
+				}
+			}
+
+			if (!same || !statesMatch("obstacle count", obstacle, state.obstacles.size(), run, tick))
+			{
+				return 1;
+			}
+		}
+	}
+
+	std::cout << "Batch environment matched the game for " << runs << " runs, " << totalTicks << " ticks" << std::endl;
+	return 0;
+}
+
+struct InputBinding
+{
+	bool useGamepad;
+	unsigned int gamepadId;
+	sf::Keyboard::Key left;
+	sf::Keyboard::Key right;
+	sf::Keyboard::Key jump;
+};
+
+//Keyboard layouts for players one to four
+const InputBinding keyboardLayouts[]{
+	{ false, 0, sf::Keyboard::Left, sf::Keyboard::Right, sf::Keyboard::Space },
+	{ false, 0, sf::Keyboard::A, sf::Keyboard::D, sf::Keyboard::W },
+	{ false, 0, sf::Keyboard::J, sf::Keyboard::L, sf::Keyboard::I },
+	{ false, 0, sf::Keyboard::Numpad4, sf::Keyboard::Numpad6, sf::Keyboard::Numpad8 }
+};
+const unsigned int keyboardLayoutCount{ sizeof(keyboardLayouts) / sizeof(keyboardLayouts[0]) };
+
+//Players keep their slot's keyboard layout unless usePad picks a gamepad for them. Players past
+//the keyboard layouts always use one. Gamepads are handed out in slot order.
+void buildInputBindings(const bool* usePad, InputBinding* bindings)
+{
+	unsigned int nextGamepad{ 0 };
+
+	for (unsigned int i{}; i < maxPlayers; ++i)
+	{
+		if (i < keyboardLayoutCount && !usePad[i])
+		{
+			bindings[i] = keyboardLayouts[i];
+		}
+		else
+		{
+			bindings[i] = InputBinding{ true, nextGamepad++, sf::Keyboard::Unknown, sf::Keyboard::Unknown, sf::Keyboard::Unknown };
+		}
+	}
+}
+
+//Routes a keyboard or gamepad event to every character bound to it
+void applyInputEvent(const sf::Event& event, std::vector<Character*>& players, const InputBinding* bindings)
+{
+	const float axisDeadZone{ 50 };
+
+	for (unsigned int i{}; i < players.size(); ++i)
+	{
+		const InputBinding& binding{ bindings[players[i]->getPlayerSlot() % maxPlayers] };
+		Character* player{ players[i] };
+
+		if (!binding.useGamepad && (event.type == sf::Event::KeyPressed || event.type == sf::Event::KeyReleased))
+		{
+			bool pressed{ event.type == sf::Event::KeyPressed };
+
+			if (event.key.code == binding.left)
+			{
+				player->movingLeft = pressed;
+			}
+			else if (event.key.code == binding.right)
+			{
+				player->movingRight = pressed;
+			}
+			else if (event.key.code == binding.jump)
+			{
+				player->jumping = pressed;
+			}
+		}
+		else if (binding.useGamepad && (event.type == sf::Event::JoystickButtonPressed || event.type == sf::Event::JoystickButtonReleased))
+		{
+			if (event.joystickButton.joystickId == binding.gamepadId && event.joystickButton.button == 0)
+			{
+				player->jumping = event.type == sf::Event::JoystickButtonPressed;
+			}
+		}
+		else if (binding.useGamepad && event.type == sf::Event::JoystickMoved)
+		{
+			if (event.joystickMove.joystickId == binding.gamepadId && (event.joystickMove.axis == sf::Joystick::X || event.joystickMove.axis == sf::Joystick::PovX))
+			{
+				player->movingLeft = event.joystickMove.position < -axisDeadZone;
+				player->movingRight = event.joystickMove.position > axisDeadZone;
+			}
+		}
+	}
+}
+
+//Puts the low resolution frame on screen in one full screen pass. Sharp bilinear keeps pixels square
+//at any window size by only blending across a band one output pixel wide at each texel edge,
+//then scanlines, vignette and the color grade are applied to the same sample.
+const std::string postProcessShaderSource{ R"(
+uniform sampler2D source;
+uniform vec2 sourceSize;
+uniform vec2 outputSize;
+uniform float scanlines;
+uniform float vignette;
+uniform vec3 grade;
+uniform vec3 tint;
+
+void main()
+{
+	vec2 texel = gl_TexCoord[0].xy * sourceSize;
+	vec2 scale = max(floor(outputSize / sourceSize), 1.0);
+	vec2 edge = 0.5 - 0.5 / scale;
+	vec2 fromCenter = fract(texel) - 0.5;
+	vec2 offset = (fromCenter - clamp(fromCenter, -edge, edge)) * scale + 0.5;
+	vec3 color = texture2D(source, (floor(texel) + offset) / sourceSize).rgb;
+
+	float line = 0.5 + 0.5 * cos(6.2831853 * fromCenter.y);
+	color *= mix(1.0, 0.55 + 0.45 * line, scanlines);
+
+	vec2 fromMiddle = gl_TexCoord[0].xy - 0.5;
+	color *= 1.0 - vignette * dot(fromMiddle, fromMiddle) * 2.0;
+
+	color = (color - 0.5) * grade.x + 0.5 + grade.z;
+	float luma = dot(color, vec3(0.299, 0.587, 0.114));
+	color = mix(vec3(luma), color, grade.y) * tint;
+
+	gl_FragColor = vec4(clamp(color, 0.0, 1.0), 1.0);
+}
+)" };
+
+enum class PostProcessMode
+{
+	Off,
+	Sharp,
+	Crt
+};
+
+//The default leaves the art's colors alone
+struct ColorGrade
+{
+	float contrast{ 1 };
+	float saturation{ 1 };
+	float brightness{ 0 };
+	sf::Vector3f tint{ 1, 1, 1 };
+};
+
+//Opt in with --grade, a little extra punch for the scaled up pixels
+const ColorGrade vividGrade{ 1.05f, 1.1f, 0, sf::Vector3f(1, 1, 1) };
+
+//Off, or no shader support, is the plain nearest neighbour sprite blit
+class PostProcess
+{
+private:
+	sf::RenderTexture& m_source;
+	sf::Sprite m_sprite;
+	sf::Shader m_shader;
+	bool m_useShader{ false };
+	PostProcessMode m_mode;
+	sf::Vector2u m_outputSize;
+
+	void applyMode()
+	{
+		//Sharp bilinear needs hardware filtering, the plain blit has to stay nearest
+		m_source.setSmooth(m_useShader && m_mode != PostProcessMode::Off);
+
+		if (m_useShader)
+		{
+			m_shader.setUniform("scanlines", m_mode == PostProcessMode::Crt ? 1.f : 0.f);
+			m_shader.setUniform("vignette", m_mode == PostProcessMode::Crt ? 0.35f : 0.f);
+		}
+	}
+
+public:
+	PostProcess(sf::RenderTexture& source, PostProcessMode mode, ColorGrade grade = ColorGrade{}) :
+		m_source{ source }, m_sprite{ source.getTexture() }, m_mode{ mode }
+	{
+		m_useShader = sf::Shader::isAvailable() && m_shader.loadFromMemory(postProcessShaderSource, sf::Shader::Fragment);
+
+		if (m_useShader)
+		{
+			m_shader.setUniform("source", sf::Shader::CurrentTexture);
+			m_shader.setUniform("sourceSize", (sf::Vector2f)source.getSize());
+			m_shader.setUniform("grade", sf::Glsl::Vec3(grade.contrast, grade.saturation, grade.brightness));
+			m_shader.setUniform("tint", grade.tint);
+		}
+
+		applyMode();
+	}
+
+	void cycleMode()
+	{
+		switch (m_mode)
+		{
+		case PostProcessMode::Off:
+			m_mode = PostProcessMode::Sharp;
+			break;
+
+		case PostProcessMode::Sharp:
+			m_mode = PostProcessMode::Crt;
+			break;
+
+		case PostProcessMode::Crt:
+			m_mode = PostProcessMode::Off;
+			break;
+		}
+
+		applyMode();
+	}
+
+	void draw(sf::RenderWindow& window)
+	{
+		if (!m_useShader || m_mode == PostProcessMode::Off)
+		{
+			window.draw(m_sprite);
+			return;
+		}
+
+		//Only the window size changes while running, so it is the only uniform touched per frame
+		if (window.getSize() != m_outputSize)
+		{
+			m_outputSize = window.getSize();
+			m_shader.setUniform("outputSize", (sf::Vector2f)m_outputSize);
+		}
+
+		window.draw(m_sprite, &m_shader);
+	}
+};
+
+//Paces the main loop at a fixed rate. Sleeps while the deadline is far away and spins the
+//last stretch, the spin window adapts to how late the OS actually wakes us.
+class FramePacer
+{
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	Clock::duration m_frameTime;
+	Clock::duration m_spinWindow{ std::chrono::milliseconds(2) };
+	Clock::time_point m_deadline;
+
+	//Sleeps are cut into slices this long when there is something to poll between them
+	const Clock::duration m_pollInterval{ std::chrono::milliseconds(1) };
+
+	//sf::sleep raises the Windows timer resolution for the call, a plain sleep can wake 15ms late
+	void sleepFor(Clock::duration duration)
+	{
+		sf::sleep(sf::microseconds(std::chrono::duration_cast<std::chrono::microseconds>(duration).count()));
+	}
+
+public:
+	FramePacer(unsigned int frameRate) :
+		m_frameTime{ std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / frameRate)) }, m_deadline{ Clock::now() + m_frameTime }
+	{}
+
+	//poll runs between sleep slices and while spinning so events are seen as they arrive
+	void wait(const std::function<void()>& poll = nullptr)
+	{
+		Clock::time_point sleepUntil{ m_deadline - m_spinWindow };
+		Clock::time_point now{ Clock::now() };
+		Clock::duration overshoot{ Clock::duration::zero() };
+		bool slept{ false };
+
+		while (now < sleepUntil)
+		{
+			Clock::time_point wakeTime{ poll ? std::min(sleepUntil, now + m_pollInterval) : sleepUntil };
+
+			sleepFor(wakeTime - now);
+			overshoot = std::max(overshoot, Clock::now() - wakeTime);
+			slept = true;
+
+			if (poll)
+			{
+				poll();
+			}
+			now = Clock::now();
+		}
+
+		//The window follows the worst overshoot measured, growing quickly and shrinking slowly.
+		//Half a frame only bounds it so one stall cannot leave every later frame spinning.
+		if (slept)
+		{
+			if (overshoot * 5 / 4 > m_spinWindow)
+			{
+				m_spinWindow = std::min<Clock::duration>(m_frameTime / 2, overshoot * 5 / 4);
+			}
+			else
+			{
+				m_spinWindow -= m_spinWindow / 16;
+			}
+		}
+
+		while (Clock::now() < m_deadline)
+		{
+			if (poll)
+			{
+				poll();
+			}
+			std::this_thread::yield();
+		}
+
+		m_deadline += m_frameTime;
+
+		//Missed by more than a frame, drop the backlog instead of running frames back to back
+		now = Clock::now();
+		if (now > m_deadline)
+		{
+			m_deadline = now + m_frameTime;
+		}
+	}
+};
+
+//Measures input to photon latency: a key press is stamped when polled, marked once the
+//simulation has acted on it and closed when the next frame containing that change is presented.
+//The game polls all through the frame wait, so a press is stamped within a poll slice of arriving.
+class LatencyTracker
+{
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct PendingInput
+	{
+		sf::Keyboard::Key key;
+		Clock::time_point pressTime;
+		bool applied;
+		unsigned int framesWaited;
+	};
+
+	PendingInput m_pending[8];
+	unsigned int m_pendingCount{ 0 };
+	double m_totalMs{ 0 };
+	double m_minMs{ 0 };
+	double m_maxMs{ 0 };
+	unsigned int m_samples{ 0 };
+	const unsigned int m_reportInterval{ 32 };
+
+public:
+	void keyPressed(sf::Keyboard::Key key)
+	{
+		if (m_pendingCount < sizeof(m_pending) / sizeof(m_pending[0]))
+		{
+			m_pending[m_pendingCount++] = PendingInput{ key, Clock::now(), false, 0 };
+		}
+	}
+
+	void applied(sf::Keyboard::Key key)
+	{
+		for (unsigned int i{}; i < m_pendingCount; ++i)
+		{
+			if (m_pending[i].key == key)
+			{
+				m_pending[i].applied = true;
+			}
+		}
+	}
+
+	//A jump is only applied on the tick after it fires, so unapplied inputs get one more frame.
+	//Inputs the simulation ignored (jump while airborne) are then dropped, they never reach the screen.
+	void presented()
+	{
+		Clock::time_point now{ Clock::now() };
+		unsigned int kept{ 0 };
+
+		for (unsigned int i{}; i < m_pendingCount; ++i)
+		{
+			if (!m_pending[i].applied)
+			{
+				if (++m_pending[i].framesWaited < 2)
+				{
+					m_pending[kept++] = m_pending[i];
+				}
+			}
+			else
+			{
+				double latencyMs{ std::chrono::duration<double, std::milli>(now - m_pending[i].pressTime).count() };
+
+				m_minMs = m_samples == 0 ? latencyMs : std::min(m_minMs, latencyMs);
+				m_maxMs = std::max(m_maxMs, latencyMs);
+				m_totalMs += latencyMs;
+
+				if (++m_samples % m_reportInterval == 0)
+				{
+					report();
+				}
+			}
+		}
+		m_pendingCount = kept;
+	}
+
+	void report()
+	{
+		if (m_samples > 0)
+		{
+			std::cout << "Input latency over " << m_samples << " presses: min " << m_minMs << "ms avg " << m_totalMs / m_samples << "ms max " << m_maxMs << "ms" << std::endl;
+		}
+	}
+};
+
+//Forwards one game's spectator stream to every viewer that connects, until killed
+int runRelay(unsigned short publisherPort, unsigned short viewerPort)
+{
+	spectator::Relay relay;
+	if (!relay.listen(publisherPort, viewerPort))
+	{
+		std::cout << "Could not listen on ports " << publisherPort << " and " << viewerPort << std::endl;
+		return 1;
+	}
+
+	std::cout << "Relaying games from port " << publisherPort << " to viewers on port " << viewerPort << std::endl;
+
+	unsigned int lastViewerCount{ 0 };
+
+	while (true)
+	{
+		relay.update(sf::milliseconds(5));
+
+		if (relay.getViewerCount() != lastViewerCount)
+		{
+			lastViewerCount = relay.getViewerCount();
+			std::cout << lastViewerCount << " viewers" << std::endl;
+		}
+	}
+}
+
+//Draws whatever the relay streams, the spectator never simulates anything itself
+int runSpectator(const std::string& host, unsigned short port, PostProcessMode postProcessMode, ColorGrade colorGrade)
+{
+	spectator::Viewer viewer;
+	if (!viewer.connect(host, port))
+	{
+		std::cout << "Could not reach relay at " << host << ":" << port << std::endl;
+		return 1;
+	}
+
+	sf::Vector2i targetResolution{ 320, 180 };
+
+	sf::RenderWindow window(sf::VideoMode(1280, 720), "Game - Spectating", sf::Style::Default);
+	sf::View view(sf::Vector2f(targetResolution.x / 2, targetResolution.y / 2), (sf::Vector2f)targetResolution);
+	window.setView(view);
+
+	sf::RenderTexture mainRenderTexture;
+	mainRenderTexture.create(targetResolution.x, targetResolution.y);
+	PostProcess postProcess(mainRenderTexture, postProcessMode, colorGrade);
+
+	GameAssets assets;
+	assets.load();
+	SimulationResources resources{ assets.getResources(nullptr) };
+
+	Background background(assets.background, sf::Vector2f(targetResolution.x, targetResolution.y), backgroundFarScroll);
+	background.addLayer(assets.backgroundGround, 1);
+	SpriteBatch spriteBatch;
+	sf::Sprite sprite;
+
+	FramePacer pacer(36);
 
-			LOG(isLargeBox);
+	while (window.isOpen())
+	{
+		pacer.wait();
 
-			if (isLargeBox < 33)
+		sf::Event event;
+		while (window.pollEvent(event))
+		{
+			if (event.type == sf::Event::Closed || (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Escape))
 			{
-				//sf::Vector2f(30, 30)
-				//sf::Vector2f(0, 0)
-				m_staticObjectRef->push_back(new Obstacle(m_spawnLoc, m_bigAnim, sf::Vector2f(30, 30), sf::Vector2f(0, 0), m_pixelSpeed));
+				window.close();
 			}
-			else if (isLargeBox < 66)
+			else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F4)
 			{
-				m_staticObjectRef->push_back(new Obstacle(sf::Vector2f(m_spawnLoc.x, m_spawnLoc.y + 10), m_startAnim, sf::Vector2f(20, 20), sf::Vector2f(0, 0), m_pixelSpeed));
+				postProcess.cycleMode();
 			}
-			else
+		}
+
+		if (!viewer.update())
+		{
+			std::cout << "Relay closed the connection" << std::endl;
+			break;
+		}
+
+		const spectator::FrameView& frame{ viewer.getFrame() };
+
+		mainRenderTexture.clear();
+
+		if (viewer.isSynced() && frame.backgroundOffsets.size() >= background.getLayerCount())
+		{
+			background.setState(0, frame.backgroundOffsets.data());
+			background.draw(mainRenderTexture);
+
+			for (unsigned int i{}; i < frame.entities.size(); ++i)
 			{
-				m_staticObjectRef->push_back(new Obstacle(sf::Vector2f(m_spawnLoc.x, m_spawnLoc.y - 20), m_flyingAnim, sf::Vector2f(20, 20), sf::Vector2f(0, 0), m_pixelSpeed));
+				const spectator::EntityView& entity{ frame.entities[i] };
+
+				if (entity.animation >= AnimationCount || !resources.animations[entity.animation]->textureLoaded)
+				{
+					continue;
+				}
+
+				Animation* anim{ resources.animations[entity.animation] };
+				int tileSize{ (int)(anim->texture.getSize().x / anim->frames) };
+
+				sprite.setTexture(anim->texture);
+				sprite.setTextureRect(sf::IntRect(entity.frame * tileSize, 0, tileSize, anim->texture.getSize().y));
+				sprite.setPosition(entity.x, entity.y);
+				sprite.setColor(sf::Color(entity.color));
+				spriteBatch.add(sprite, mainRenderTexture);
 			}
-			m_lastSpawn = 0;
+			spriteBatch.flush(mainRenderTexture);
 		}
 
-		GameObject::logicTick();
+		mainRenderTexture.display();
+
+		window.clear();
+		postProcess.draw(window);
+		window.display();
 	}
 
-};
+	return 0;
+}
 
-class CollisionHandler
+//Runs a headless game through a local relay into many loopback viewers, some joining late,
+//and checks every one of them ends up with exactly the frame the game published
+int testRelay(unsigned int viewerCount, unsigned int ticks)
 {
-private:
-	bool checkAxis(GameObject* currentObject, GameObject* checkObject, int vertexToCheck, bool checkX)
+	const unsigned short publisherPort{ spectator::defaultPublisherPort };
+	const unsigned short viewerPort{ spectator::defaultViewerPort };
+
+	spectator::Relay relay;
+	if (!relay.listen(publisherPort, viewerPort))
 	{
-		sf::Vertex* currentMax{currentObject->getCollision()->getLines() + vertexToCheck};
-		sf::Vertex* currentMin = currentMax + 1;
+		std::cout << "Could not listen on ports " << publisherPort << " and " << viewerPort << std::endl;
+		return 1;
+	}
 
-		sf::Vertex* checkMax{checkObject->getCollision()->getLines() + vertexToCheck};
-		sf::Vertex* checkMin = checkMax + 1;
+	std::atomic<bool> relayRunning{ true };
+	std::thread relayThread([&relay, &relayRunning] { while (relayRunning) { relay.update(sf::milliseconds(2)); } });
 
-		bool MaxWithinBounds{};
-		bool MinWithinBounds{};
+	GameAssets assets;
+	assets.load();
 
-		if (checkX)
+	sf::Sound silentJump;
+	World world(assets.getResources(&silentJump), assets.background, assets.backgroundGround, sf::Vector2i(320, 180), 1);
+
+	spectator::Broadcaster broadcaster;
+	broadcaster.connect("127.0.0.1", publisherPort);
+
+	std::vector<std::unique_ptr<spectator::Viewer>> viewers;
+	spectator::FrameView frame;
+
+	auto testStart{ std::chrono::steady_clock::now() };
+
+	for (unsigned int tick{}; tick < ticks; ++tick)
+	{
+		//Half join up front, the rest trickle in over the first half of the run
+		unsigned int joined{ std::min(viewerCount, viewerCount / 2 + viewerCount * tick / std::max(1u, ticks)) };
+
+		while (viewers.size() < joined)
 		{
-			MaxWithinBounds = (currentMax->position.x >= checkMax->position.x) && (currentMax->position.x <= checkMin->position.x);
-			MinWithinBounds = (currentMin->position.x >= checkMax->position.x) && (currentMin->position.x <= checkMin->position.x);
+			viewers.push_back(std::unique_ptr<spectator::Viewer>(new spectator::Viewer()));
+			viewers.back()->connect("127.0.0.1", viewerPort);
 		}
-		else
+
+		world.logicTick();
+		world.captureView(frame);
+		broadcaster.publish(frame);
+
+		for (unsigned int i{}; i < viewers.size(); ++i)
 		{
-			MaxWithinBounds = (currentMax->position.y >= checkMax->position.y) && (currentMax->position.y <= checkMin->position.y);
-			MinWithinBounds = (currentMin->position.y >= checkMax->position.y) && (currentMin->position.y <= checkMin->position.y);
+			viewers[i]->update();
 		}
 
-		return (MaxWithinBounds || MinWithinBounds);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
 	}
 
-public:
-	CollisionHandler(GameObject* objectToTest, std::vector<GameObject*> objectsToTestAgainst)
+	//Keep republishing the last frame until the stream has drained
+	unsigned int inSync{};
+
+	for (unsigned int attempt{}; attempt < 500 && inSync < viewers.size(); ++attempt)
 	{
-		std::vector<GameObject*> tempVector;
+		broadcaster.publish(frame);
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
 
-		for (unsigned int j{}; j < objectsToTestAgainst.size(); ++j)
+		inSync = 0;
+		for (unsigned int i{}; i < viewers.size(); ++i)
 		{
-				bool xCollides{ checkAxis(objectToTest, objectsToTestAgainst[j], 0, true) };
-				bool yCollides{ checkAxis(objectToTest, objectsToTestAgainst[j], 2, false) };
+			viewers[i]->update();
 
-				if (xCollides && yCollides)
-				{
-					tempVector.push_back(objectsToTestAgainst[j]);
-				}
+			if (viewers[i]->isSynced() && spectator::sameFrame(viewers[i]->getFrame(), frame))
+			{
+				++inSync;
+			}
 		}
-		objectToTest->checkCollision(tempVector);
 	}
+
+	double seconds{ std::chrono::duration<double>(std::chrono::steady_clock::now() - testStart).count() };
+
+	relayRunning = false;
+	relayThread.join();
+
+	std::cout << inSync << " of " << viewers.size() << " viewers in sync after " << relay.getMessagesReceived() << " messages in " << seconds << "s" << std::endl;
+
+	return inSync == viewers.size() && broadcaster.isConnected() ? 0 : 1;
+}
+
+//Takes the next argument only when it is a number no larger than max, so an optional value never swallows a flag
+bool readNumberArgument(int argc, char* argv[], int& i, unsigned long max, unsigned int& value)
+{
+	if (i + 1 >= argc)
+	{
+		return false;
+	}
+
+	std::string next{ argv[i + 1] };
+
+	if (next.empty() || next.size() > 9 || next.find_first_not_of("0123456789") != std::string::npos || std::strtoul(next.c_str(), nullptr, 10) > max)
+	{
+		return false;
+	}
+
+	value = (unsigned int)std::strtoul(next.c_str(), nullptr, 10);
+	++i;
+	return true;
+}
+
+enum class NetworkMode
+{
+	None,
+	Relay,
+	Spectate,
+	RelayTest
 };
 
-int main()
+int main(int argc, char* argv[])
 {
 	bool playing{ true };
 
-	while (playing)
+	bool useVsync{ false };
+	bool measureLatency{ false };
+	bool useTelemetry{ true };
+	std::string broadcastHost;
+	PostProcessMode postProcessMode{ PostProcessMode::Sharp };
+	ColorGrade colorGrade;
+	unsigned int playerCount{ 1 };
+	bool usePad[maxPlayers]{};
+
+	//Network modes run once every flag is read, so display flags after them still apply
+	NetworkMode networkMode{ NetworkMode::None };
+	std::string spectateHost;
+	unsigned int publisherPort{ spectator::defaultPublisherPort };
+	unsigned int viewerPort{ spectator::defaultViewerPort };
+	unsigned int testViewerCount{ 200 };
+	unsigned int testTicks{ 720 };
+
+	for (int i{ 1 }; i < argc; ++i)
 	{
-		srand(time(nullptr));
+		std::string argument{ argv[i] };
 
-		//Initial window settings
-		sf::Vector2i targetResolution{ 320, 180 };
+		if (argument == "--vsync")
+		{
+			useVsync = true;
+		}
+		else if (argument == "--crt")
+		{
+			postProcessMode = PostProcessMode::Crt;
+		}
+		else if (argument == "--no-postfx")
+		{
+			postProcessMode = PostProcessMode::Off;
+		}
+		else if (argument == "--grade")
+		{
+			colorGrade = vividGrade;
+		}
+		else if (argument == "--latency")
+		{
+			measureLatency = true;
+		}
+		else if (argument == "--no-telemetry")
+		{
+			useTelemetry = false;
+		}
+		else if (argument == "--decode" && i + 1 < argc)
+		{
+			//--decode <telemetry file>, prints one event per line
+			return telemetry::decode(argv[i + 1], std::cout) ? 0 : 1;
+		}
+		else if (argument == "--broadcast" && i + 1 < argc)
+		{
+			//--broadcast <relay host> [publisher port], streams every tick to a relay for spectators
+			broadcastHost = argv[++i];
+			readNumberArgument(argc, argv, i, 65535, publisherPort);
+		}
+		else if (argument == "--relay")
+		{
+			//--relay [publisher port] [viewer port]
+			networkMode = NetworkMode::Relay;
 
-		sf::RenderWindow window(sf::VideoMode(1280, 720), "Game", sf::Style::Default);
-		window.setKeyRepeatEnabled(false);
-		window.setFramerateLimit(36);
-		sf::View view(sf::Vector2f(targetResolution.x / 2, targetResolution.y / 2), (sf::Vector2f)targetResolution);
-		window.setView(view);
+			if (readNumberArgument(argc, argv, i, 65535, publisherPort))
+			{
+				readNumberArgument(argc, argv, i, 65535, viewerPort);
+			}
+		}
+		else if (argument == "--spectate" && i + 1 < argc)
+		{
+			//--spectate <relay host> [viewer port]
+			networkMode = NetworkMode::Spectate;
+			spectateHost = argv[++i];
+			readNumberArgument(argc, argv, i, 65535, viewerPort);
+		}
+		else if (argument == "--relay-test")
+		{
+			//--relay-test [viewers] [ticks], everything over loopback
+			networkMode = NetworkMode::RelayTest;
 
-		//Create render texture and sprite
-		sf::RenderTexture mainRenderTexture;
-		mainRenderTexture.create(targetResolution.x, targetResolution.y);
-		sf::Sprite mainRenderSprite(mainRenderTexture.getTexture());
+			if (readNumberArgument(argc, argv, i, 100000, testViewerCount))
+			{
+				readNumberArgument(argc, argv, i, 100000000, testTicks);
+			}
+		}
+		else if (argument == "--pad")
+		{
+			//--pad <player>, gives that player (1 to 8) a gamepad instead of their keyboard layout
+			unsigned int player{};
 
-		//Create test background
-		sf::Texture background;
-		background.loadFromFile("Textures/Background.png");
-		sf::Sprite backgroundSprite(background);
+			if (readNumberArgument(argc, argv, i, maxPlayers, player) && player > 0)
+			{
+				usePad[player - 1] = true;
+			}
+		}
+		else if (argument == "--players" && i + 1 < argc)
+		{
+			playerCount = std::max(1, std::min((int)maxPlayers, std::atoi(argv[++i])));
+		}
+		else if (argument == "--tune")
+		{
+			//--tune [environments] [steps]
+			unsigned int envCount{ 4096 };
+			unsigned int steps{ 10000 };
 
-		sf::Texture playerTexture;
-		playerTexture.loadFromFile("Textures/KiwiRun.png");
+			if (readNumberArgument(argc, argv, i, 1000000, envCount))
+			{
+				readNumberArgument(argc, argv, i, 100000000, steps);
+			}
 
-		sf::Texture rockTexture;
-		rockTexture.loadFromFile("Textures/Rock.png");
+			return tuneDifficulty(std::max(1u, envCount), steps);
+		}
+		else if (argument == "--verify-env")
+		{
+			//--verify-env [runs] [ticks per run]
+			unsigned int runs{ 50 };
+			unsigned int ticks{ 20000 };
 
-		sf::Texture stumpTexture;
-		stumpTexture.loadFromFile("Textures/Stump.png");
+			if (readNumberArgument(argc, argv, i, 100000, runs))
+			{
+				readNumberArgument(argc, argv, i, 100000000, ticks);
+			}
 
-		sf::Texture treeTexture;
-		treeTexture.loadFromFile("Textures/Tree.png");
+			return verifyEnvironment(std::max(1u, runs), std::max(1u, ticks));
+		}
+		else if (argument == "--export" && i + 2 < argc)
+		{
+			//--export <replay> <png folder | raw file> [png|raw]
+			capture::Format format{ capture::Format::Png };
 
-		sf::Texture machineTexture;
-		machineTexture.loadFromFile("Textures/Machine.png");
+			if (i + 3 < argc && std::string(argv[i + 3]) == "raw")
+			{
+				format = capture::Format::Raw;
+			}
+
+			return exportReplay(argv[i + 1], argv[i + 2], format);
+		}
+	}
+
+	switch (networkMode)
+	{
+	case NetworkMode::Relay:
+		return runRelay((unsigned short)publisherPort, (unsigned short)viewerPort);
 
-		sf::Texture emptyTexture;
+	case NetworkMode::Spectate:
+		return runSpectator(spectateHost, (unsigned short)viewerPort, postProcessMode, colorGrade);
 
-		//Create animations
+	case NetworkMode::RelayTest:
+		return testRelay(std::max(1u, testViewerCount), std::max(1u, testTicks));
+
+	case NetworkMode::None:
+		break;
+	}
+
+	InputBinding inputBindings[maxPlayers];
+	buildInputBindings(usePad, inputBindings);
+
+	//Structured event log, cheap enough to leave on, read it back with --decode
+	if (useTelemetry && !telemetry::start("telemetry.bin"))
+	{
+		std::cout << "Could not open telemetry.bin" << std::endl;
+	}
+
+	while (playing)
+	{
+		//Initial window settings
+		sf::Vector2i targetResolution{ 320, 180 };
+
+		sf::RenderWindow window(sf::VideoMode(1280, 720), "Game", sf::Style::Default);
+		window.setKeyRepeatEnabled(false);
+		window.setVerticalSyncEnabled(useVsync);
+		sf::View view(sf::Vector2f(targetResolution.x / 2, targetResolution.y / 2), (sf::Vector2f)targetResolution);
+		window.setView(view);
 
-		Background backgroundObject(background);
+		//Create render texture and the pass that scales it to the window
+		sf::RenderTexture mainRenderTexture;
+		mainRenderTexture.create(targetResolution.x, targetResolution.y);
+		PostProcess postProcess(mainRenderTexture, postProcessMode, colorGrade);
 
-		Animation playerRun{ playerTexture, 6, true };
-		Animation rock{ rockTexture, 1, true };
-		Animation stump{ stumpTexture, 1, true };
-		Animation tree{ treeTexture, 1, true };
-		Animation machine{ machineTexture, 2, true };
-		Animation emptyAnim{ emptyTexture, 0 , false };
+		//Load textures and create animations
+		GameAssets assets;
+		assets.load();
 
 		//Create sounds
 		
@@ -658,34 +2925,74 @@ int main()
 		deathSound.setBuffer(deathBuffer);
 
 		//Create objects
-		Character* playerRef{ new Character(sf::Vector2f(100, 130), &playerRun,sf::Vector2f(16, 16), sf::Vector2f(0, 0), &jumpSound)};
-
-		std::vector<GameObject*> staticObjects;
-		std::vector<GameObject*> dynamicObjects;
-
-		staticObjects.push_back(new Ground(sf::Vector2f(-100, 150), &emptyAnim, sf::Vector2f(500, 30), sf::Vector2f(0, 0)));
-		staticObjects.push_back(new Ground(sf::Vector2f(0, -10), &emptyAnim, sf::Vector2f(319, 10), sf::Vector2f(0, 0)));
-		staticObjects.push_back(new ObstacleSpawner(&staticObjects, sf::Vector2f(310, 0), &stump, &rock, &tree, &emptyAnim, sf::Vector2f(10, 180), sf::Vector2f(0, 0), sf::Vector2f(320, 120)));
+		World world(assets.getResources(&jumpSound), assets.background, assets.backgroundGround, targetResolution, (std::uint32_t)time(nullptr), playerCount);
 
-		GameObject* isKillVolume{ new Ground(sf::Vector2f(0, -30), &machine, sf::Vector2f(51, targetResolution.y + 30), sf::Vector2f(-50, 0)) };
-		isKillVolume->setCollisionIsKill(true);
-		staticObjects.push_back(isKillVolume);
+		//Start of run and a player set checkpoint, restoring either is an instant restart
+		SimulationSnapshot startSnapshot{};
+		world.capture(startSnapshot);
+		SimulationSnapshot checkpoint{ startSnapshot };
 
-		dynamicObjects.push_back(playerRef);
+		//Every run is recorded and written out when it ends, --export renders it
+		Replay recording;
+		recording.start = startSnapshot;
+		recording.playerCount = playerCount;
+		bool recordingSaved{ false };
 
 		bool isPaused{ false };
+		unsigned int alivePlayers{ playerCount };
 
-		unsigned int frameCount{ 0 };
+		//Spectators get every simulated tick through the relay
+		spectator::Broadcaster broadcaster;
+		spectator::FrameView spectatorFrame;
+
+		if (!broadcastHost.empty() && !broadcaster.connect(broadcastHost, (unsigned short)publisherPort))
+		{
+			std::cout << "Could not reach relay at " << broadcastHost << std::endl;
+		}
 
 		hurtSound.setLoop(true);
 		hurtSound.setVolume(10);
 		hurtSound.play();
 
-		while (window.isOpen())
+		//Input is applied right after the wait so it is as fresh as possible when the tick runs.
+		//Events are still pulled in during the wait so key presses are stamped when they arrive.
+		FramePacer pacer(36);
+		LatencyTracker latency;
+		std::vector<sf::Event> events;
+
+		std::function<void()> pollEvents{ [&]()
 		{
 			sf::Event event;
 			while (window.pollEvent(event))
 			{
+				if (measureLatency && event.type == sf::Event::KeyPressed)
+				{
+					latency.keyPressed(event.key.code);
+				}
+
+				events.push_back(event);
+			}
+		} };
+
+		auto lastFrameStart{ std::chrono::steady_clock::now() };
+
+		while (window.isOpen())
+		{
+			pacer.wait(pollEvents);
+
+			auto frameStart{ std::chrono::steady_clock::now() };
+			float frameMs{ std::chrono::duration<float, std::milli>(frameStart - lastFrameStart).count() };
+			float logicMs{ 0 };
+			lastFrameStart = frameStart;
+
+			std::vector<Character*>& players{ world.getPlayers() };
+
+			pollEvents();
+			for (unsigned int e{}; e < events.size(); ++e)
+			{
+				const sf::Event& event{ events[e] };
+
+				applyInputEvent(event, players, inputBindings);
 
 				switch (event.type)
 				{
@@ -703,17 +3010,52 @@ int main()
 					case sf::Keyboard::F11:
 						break;
 
-					case sf::Keyboard::Space:
-						playerRef->jumping = true;
+					case sf::Keyboard::F3:
+						world.toggleDebugDraw();
+						break;
+
+					case sf::Keyboard::F4:
+						postProcess.cycleMode();
 						break;
 
-					case sf::Keyboard::Right:
-						playerRef->movingRight = true;
+					case sf::Keyboard::F5:
+						if (!isPaused && !world.capture(checkpoint))
+						{
+							LOG("Checkpoint skipped, too many objects");
+						}
 						break;
 
-					case sf::Keyboard::Left:
-						playerRef->movingLeft = true;
+					case sf::Keyboard::R:
+					case sf::Keyboard::F9:
+					{
+						auto restoreStart{ std::chrono::steady_clock::now() };
+
+						//A restart is a new run with its own obstacles, a checkpoint replays the same ones
+						if (event.key.code == sf::Keyboard::R)
+						{
+							std::uint32_t seed{ (std::uint32_t)std::chrono::steady_clock::now().time_since_epoch().count() };
+							startSnapshot.randomState = seed ? seed : 1;
+						}
+
+						const SimulationSnapshot& snapshot{ event.key.code == sf::Keyboard::R ? startSnapshot : checkpoint };
+						world.restore(snapshot);
+
+						recording.start = snapshot;
+						recording.inputs.clear();
+						recordingSaved = false;
+						LOG("Restore took " << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - restoreStart).count() << "us");
+
+						alivePlayers = world.countAlivePlayers();
+						broadcaster.forceKeyframe();
+
+						if (isPaused)
+						{
+							isPaused = false;
+							deathSound.stop();
+							hurtSound.play();
+						}
 						break;
+					}
 
 					case sf::Keyboard::Escape:
 						playing = false;
@@ -721,163 +3063,91 @@ int main()
 						break;
 					}
 					break;
-
-				case sf::Event::KeyReleased:
-					switch (event.key.code)
-					{
-					case sf::Keyboard::Right:
-						playerRef->movingRight = false;
-						break;
-
-					case sf::Keyboard::Left:
-						playerRef->movingLeft = false;
-						break;
-
-					case sf::Keyboard::Space:
-						playerRef->jumping = false;
-					}
 				}
 			}
+			events.clear();
+
 			//~~LOGIC FRAME~~
 			if (!isPaused)
 			{
-
-				backgroundObject.tick();
-
-				//Check Collision
-				for (unsigned int i{}; i < dynamicObjects.size(); ++i)
+				for (unsigned int i{}; i < players.size(); ++i)
 				{
-					CollisionHandler handler(dynamicObjects[i], staticObjects);
+					recording.inputs.push_back(players[i]->getInput());
 				}
 
-				//Update static objects
-				for (unsigned int i{}; i < staticObjects.size(); ++i)
-				{
-					staticObjects[i]->logicTick();
-				}
+				auto logicStart{ std::chrono::steady_clock::now() };
+				world.logicTick();
+				logicMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - logicStart).count();
 
-				//Update dynamic objects
-				for (unsigned int i{}; i < dynamicObjects.size(); ++i)
+				if (!broadcastHost.empty())
 				{
-					dynamicObjects[i]->logicTick();
+					world.captureView(spectatorFrame);
+					broadcaster.publish(spectatorFrame);
 				}
 
-				//Check distances
-
-				for (unsigned int i{}; i < staticObjects.size(); ++i)
+				//Movement keys act on the tick that follows them, jumps only when one fired
+				for (unsigned int i{}; i < players.size(); ++i)
 				{
-					sf::Vector2f testLoc = (staticObjects[i]->getLocation());
+					const InputBinding& binding{ inputBindings[players[i]->getPlayerSlot() % maxPlayers] };
+
+					latency.applied(binding.left);
+					latency.applied(binding.right);
 
-					if ((testLoc.x < 0 - 100 || testLoc.x > targetResolution.x + 100) || (testLoc.y < 0 - 100 || testLoc.y > targetResolution.y + 100))
+					if (players[i]->consumeJumped())
 					{
-						staticObjects[i]->setKill(true);
+						latency.applied(binding.jump);
 					}
 				}
 
-				for (unsigned int i{}; i < dynamicObjects.size(); ++i)
-				{
-					sf::Vector2f testLoc = (dynamicObjects[i]->getLocation());
+				//A death sound for every player lost, the run ends with the last one
+				unsigned int stillAlive{ world.countAlivePlayers() };
 
-					if ((testLoc.x < 0 - 100 || testLoc.x > targetResolution.x + 100) || (testLoc.y < 0 - 100 || testLoc.y > targetResolution.y + 100))
-					{
-						dynamicObjects[i]->setKill(true);
-					}
+				if (stillAlive < alivePlayers)
+				{
+					deathSound.play();
 				}
+				alivePlayers = stillAlive;
 
-				//Check if player is flagged kill
-				if (playerRef->getKill())
+				if (alivePlayers == 0)
 				{
 					LOG("END GAME");
 					isPaused = true;
-					deathSound.play();
 					hurtSound.stop();
-				}
-
-				//Delete flagged objects
-				for (unsigned int i{ staticObjects.size() }; i-- > 0;)
-				{
-					if (staticObjects[i]->getKill())
-					{
-						delete staticObjects[i];
-						staticObjects.erase(staticObjects.begin() + i);
-					}
-				}
 
-				for (unsigned int i{ dynamicObjects.size() }; i-- > 0;)
-				{
-					if (dynamicObjects[i]->getKill())
-					{
-						delete dynamicObjects[i];
-						dynamicObjects.erase(dynamicObjects.begin() + i);
-					}
-				}
-
-				//LOG(frameCount);
-
-				if (++frameCount >= 2)
-				{
-					frameCount = 0;
-
-					LOG("--Update frame--");
-
-					//Graphic update static objects
-
-					for (unsigned int i{}; i < staticObjects.size(); ++i)
-					{
-						staticObjects[i]->graphicTick(mainRenderTexture);
-					}
-
-					//Graphic update dynamic objects
-
-					for (unsigned int i{}; i < dynamicObjects.size(); ++i)
-					{
-						dynamicObjects[i]->graphicTick(mainRenderTexture);
-					}
+					recording.save("last.replay");
+					recordingSaved = true;
 				}
 			}
 
 			//~~DRAW FRAME~~
 
-			mainRenderTexture.clear();
-			backgroundObject.draw(mainRenderTexture);
-
-			//Draw static objects
-			for (unsigned int i{}; i < staticObjects.size(); ++i)
-			{
-				staticObjects[i]->drawObject(mainRenderTexture);
-			}
-
-			//Draw dynamic objects
-
-			for (unsigned int i{}; i < dynamicObjects.size(); ++i)
-			{
-				dynamicObjects[i]->drawObject(mainRenderTexture);
-			}
+			auto drawStart{ std::chrono::steady_clock::now() };
 
+			mainRenderTexture.clear();
+			world.draw(mainRenderTexture);
 			mainRenderTexture.display();
 
 			window.clear();
-			window.draw(mainRenderSprite);
+			postProcess.draw(window);
 			window.display();
-		}
 
-		//~~CLEAN UP~~
+			latency.presented();
 
-		//Delete static objects
+			telemetry::record(telemetry::EventType::FrameStats, frameMs, logicMs, std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - drawStart).count(), (float)world.countVisible());
+		}
 
-		for (unsigned int i{}; i < staticObjects.size(); ++i)
+		if (measureLatency)
 		{
-			delete staticObjects[i];
+			latency.report();
 		}
 
-		//Delete dynamic objects
-
-
-		for (unsigned int i{}; i < dynamicObjects.size(); ++i)
+		if (!recordingSaved)
 		{
-			delete dynamicObjects[i];
+			recording.save("last.replay");
 		}
 	}
 
+	telemetry::stop();
+
 	return 0;
-}
\ No newline at end of file
+}